@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include "arbiter.h"
+
+static INIT_ONCE g_arbiter_once = INIT_ONCE_STATIC_INIT;
+static PHWBP_ARBITER g_arbiter = NULL; // NULL if the section is unavailable, arbitration is then off
+static PHWBP_ARBITER_OWNER g_owner = NULL;
+
+static BOOL CALLBACK arbiter_map(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    UNREFERENCED_PARAMETER(once);
+    UNREFERENCED_PARAMETER(param);
+    UNREFERENCED_PARAMETER(context);
+
+    CHAR name[64];
+    sprintf_s(name, sizeof(name), "Local\\hwbp-arbiter-%lu", GetCurrentProcessId());
+
+    // the handle is kept for the lifetime of the process so the section outlives any one copy
+    HANDLE hSection = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(HWBP_ARBITER), name);
+    if (!hSection)
+        return TRUE;
+
+    PHWBP_ARBITER arbiter = (PHWBP_ARBITER)MapViewOfFile(hSection, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(HWBP_ARBITER));
+    if (!arbiter)
+    {
+        CloseHandle(hSection);
+        return TRUE;
+    }
+
+    // sections start zeroed, the first copy stamps its layout version
+    LONG version = InterlockedCompareExchange(&arbiter->version, HWBP_ARBITER_VERSION, 0);
+    if (version != 0 && version != HWBP_ARBITER_VERSION)
+    {
+        UnmapViewOfFile(arbiter);
+        CloseHandle(hSection);
+        return TRUE;
+    }
+
+    g_arbiter = arbiter;
+    return TRUE;
+}
+
+static PHWBP_ARBITER arbiter_get(void)
+{
+    InitOnceExecuteOnce(&g_arbiter_once, arbiter_map, NULL, NULL);
+    return g_arbiter;
+}
+
+void bp_arbiter_lock(void)
+{
+    PHWBP_ARBITER arbiter = arbiter_get();
+    if (!arbiter)
+        return;
+
+    // a spin lock since the copies may see the section at different addresses
+    for (DWORD spins = 0; InterlockedCompareExchange(&arbiter->lock, 1, 0) != 0; spins++)
+    {
+        if (spins < 64)
+            YieldProcessor();
+        else
+            SwitchToThread();
+    }
+}
+
+void bp_arbiter_unlock(void)
+{
+    if (g_arbiter)
+        InterlockedExchange(&g_arbiter->lock, 0);
+}
+
+// caller holds the arbiter lock
+static BOOL arbiter_register(LPCSTR name, uint8_t quota)
+{
+    if (g_owner)
+        return TRUE;
+
+    for (LONG i = 0; i < HWBP_ARBITER_OWNERS; i++)
+    {
+        PHWBP_ARBITER_OWNER owner = &g_arbiter->owners[i];
+
+        if (owner->id)
+            continue;
+
+        owner->id = i + 1;
+        owner->quota = quota;
+        strncpy_s(owner->name, sizeof(owner->name), name, _TRUNCATE);
+        g_owner = owner;
+
+        return TRUE;
+    }
+
+    SetLastError(ERROR_QUOTA_EXCEEDED);
+    return FALSE;
+}
+
+BOOL bp_arbiter_register(LPCSTR name, uint8_t quota)
+{
+    if (quota < 1 || quota > 4)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    if (!arbiter_get())
+        return TRUE;
+
+    bp_arbiter_lock();
+    BOOL ok = arbiter_register(name, quota);
+    bp_arbiter_unlock();
+
+    return ok;
+}
+
+void bp_arbiter_unregister(void)
+{
+    if (!arbiter_get() || !g_owner)
+        return;
+
+    bp_arbiter_lock();
+
+    for (DWORD i = 0; i < HWBP_ARBITER_THREADS; i++)
+    {
+        for (int8_t j = 0; j < 4; j++)
+        {
+            if (g_arbiter->threads[i].owner[j] == g_owner->id)
+                g_arbiter->threads[i].owner[j] = 0;
+        }
+    }
+
+    g_owner->id = 0;
+    g_owner = NULL;
+
+    bp_arbiter_unlock();
+}
+
+static PHWBP_ARBITER_THREAD arbiter_thread(DWORD threadId, BOOL insert)
+{
+    PHWBP_ARBITER_THREAD reuse = NULL;
+
+    // same probing scheme as the per-copy table in hwbp.c
+    for (DWORD i = 0; i < HWBP_ARBITER_THREADS; i++)
+    {
+        PHWBP_ARBITER_THREAD t = &g_arbiter->threads[(threadId / 4 + i) % HWBP_ARBITER_THREADS];
+
+        if (t->threadId == threadId)
+            return t;
+
+        if (t->threadId == 0)
+        {
+            if (!reuse)
+                reuse = t;
+            break;
+        }
+
+        if (!reuse && !t->owner[0] && !t->owner[1] && !t->owner[2] && !t->owner[3])
+            reuse = t;
+    }
+
+    if (!insert)
+        return NULL;
+
+    if (reuse)
+        reuse->threadId = threadId;
+
+    return reuse;
+}
+
+// caller holds the arbiter lock
+LONG bp_arbiter_slot(DWORD threadId, int8_t index)
+{
+    if (!g_arbiter || index < 0 || index > 3)
+        return 0;
+
+    PHWBP_ARBITER_THREAD t = arbiter_thread(threadId, FALSE);
+
+    return t ? t->owner[index] : 0;
+}
+
+LONG bp_arbiter_owner(DWORD threadId, int8_t index)
+{
+    if (!arbiter_get())
+        return 0;
+
+    bp_arbiter_lock();
+    LONG owner = bp_arbiter_slot(threadId, index);
+    bp_arbiter_unlock();
+
+    return owner;
+}
+
+LONG bp_arbiter_self(void)
+{
+    return g_owner ? g_owner->id : 0;
+}
+
+// caller holds the arbiter lock
+BOOL bp_arbiter_claim(DWORD threadId, int8_t index)
+{
+    if (!g_arbiter)
+        return TRUE;
+
+    if (!g_owner && !arbiter_register("hwbp", 4))
+        return FALSE;
+
+    PHWBP_ARBITER_THREAD t = arbiter_thread(threadId, TRUE);
+    if (!t || t->owner[index])
+        return FALSE;
+
+    uint8_t used = 0;
+    for (int8_t i = 0; i < 4; i++)
+        used += t->owner[i] == g_owner->id;
+
+    if (used >= g_owner->quota)
+        return FALSE;
+
+    t->owner[index] = g_owner->id;
+    return TRUE;
+}
+
+// caller holds the arbiter lock
+void bp_arbiter_release(DWORD threadId, int8_t index)
+{
+    if (!g_arbiter || !g_owner)
+        return;
+
+    PHWBP_ARBITER_THREAD t = arbiter_thread(threadId, FALSE);
+    if (t && t->owner[index] == g_owner->id)
+        t->owner[index] = 0;
+}
+
+// caller holds the arbiter lock
+LONG bp_arbiter_generation(DWORD threadId)
+{
+    if (!g_arbiter)
+        return 0;
+
+    PHWBP_ARBITER_THREAD t = arbiter_thread(threadId, FALSE);
+
+    return t ? t->generation : -1;
+}
+
+// caller holds the arbiter lock
+LONG bp_arbiter_touch(DWORD threadId)
+{
+    if (!g_arbiter)
+        return 0;
+
+    PHWBP_ARBITER_THREAD t = arbiter_thread(threadId, TRUE);
+    if (!t)
+        return -1;
+
+    // process-wide counter so a reused entry never repeats a generation
+    t->generation = ++g_arbiter->generation;
+
+    return t->generation;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+// Process-wide debug register slot arbiter. Every copy of hwbp linked into the process
+// (static libraries in different DLLs, say) maps the same named section, records which
+// owner holds which slot of which thread there, and serializes debug register updates
+// through its lock, so the copies neither pick the same slot nor lose each other's DR7
+// bits. Slots used outside of hwbp (a debugger) are still detected through DR7.
+
+#define HWBP_ARBITER_VERSION 2
+#define HWBP_ARBITER_OWNERS 32
+#define HWBP_ARBITER_THREADS 1024
+
+typedef struct _HWBP_ARBITER_OWNER
+{
+    volatile LONG id; // 0 when the entry is free
+    uint8_t quota;    // slots per thread
+    CHAR name[27];
+} HWBP_ARBITER_OWNER, *PHWBP_ARBITER_OWNER;
+
+typedef struct _HWBP_ARBITER_THREAD
+{
+    volatile DWORD threadId;
+    LONG owner[4];
+    LONG generation; // bumped by every copy on each debug register write to the thread
+} HWBP_ARBITER_THREAD, *PHWBP_ARBITER_THREAD;
+
+typedef struct _HWBP_ARBITER
+{
+    volatile LONG version;
+    volatile LONG lock;
+    LONG generation;
+    HWBP_ARBITER_OWNER owners[HWBP_ARBITER_OWNERS];
+    HWBP_ARBITER_THREAD threads[HWBP_ARBITER_THREADS];
+} HWBP_ARBITER, *PHWBP_ARBITER;
+
+EXTERN_C_START
+
+// Registers this copy of the library under a name with a per-thread slot quota (1-4).
+// Optional, the first arm registers a default owner with a quota of 4.
+BOOL bp_arbiter_register(LPCSTR name, uint8_t quota);
+
+// Releases every slot recorded for this copy, e.g. before its module unloads.
+// Its breakpoints must already be disabled.
+void bp_arbiter_unregister(void);
+
+// Owner id holding slot index of threadId, 0 if none. Owner ids are process-wide.
+LONG bp_arbiter_owner(DWORD threadId, int8_t index);
+LONG bp_arbiter_self(void);
+
+// Used by hwbp.c around and during debug register updates.
+void bp_arbiter_lock(void);
+void bp_arbiter_unlock(void);
+BOOL bp_arbiter_claim(DWORD threadId, int8_t index);
+LONG bp_arbiter_slot(DWORD threadId, int8_t index); // bp_arbiter_owner under the lock
+void bp_arbiter_release(DWORD threadId, int8_t index);
+
+// Lets a copy tell whether its cached image of a thread's debug registers is still
+// current: touch after writing them, compare generation before trusting the cache.
+LONG bp_arbiter_generation(DWORD threadId);
+LONG bp_arbiter_touch(DWORD threadId);
+
+EXTERN_C_END
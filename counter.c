@@ -0,0 +1,39 @@
+#include <malloc.h>
+#include <string.h>
+#include "counter.h"
+
+PHWBP_COUNTER bp_counter_create(void)
+{
+    PHWBP_COUNTER counter = (PHWBP_COUNTER)_aligned_malloc(sizeof(HWBP_COUNTER), 64);
+    if (!counter)
+        return NULL;
+
+    memset(counter, 0, sizeof(HWBP_COUNTER));
+
+    return counter;
+}
+
+void bp_counter_destroy(PHWBP_COUNTER counter)
+{
+    _aligned_free(counter);
+}
+
+LONG64 bp_counter_read(PHWBP_COUNTER counter)
+{
+    LONG64 sum = 0;
+
+    for (DWORD i = 0; i < HWBP_COUNTER_SHARDS; i++)
+        sum += counter->shards[i].value;
+
+    return sum;
+}
+
+LONG64 bp_counter_reset(PHWBP_COUNTER counter)
+{
+    LONG64 sum = 0;
+
+    for (DWORD i = 0; i < HWBP_COUNTER_SHARDS; i++)
+        sum += InterlockedExchange64(&counter->shards[i].value, 0);
+
+    return sum;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+
+// Hit counter split into cache-line sized shards indexed by processor, so threads
+// hitting the same watch on different CPUs never write to the same line. The
+// shards are only summed when the counter is read.
+
+#define HWBP_COUNTER_SHARDS 64
+
+typedef struct _HWBP_COUNTER_SHARD
+{
+    DECLSPEC_ALIGN(64) volatile LONG64 value;
+} HWBP_COUNTER_SHARD;
+
+typedef struct _HWBP_COUNTER
+{
+    HWBP_COUNTER_SHARD shards[HWBP_COUNTER_SHARDS];
+} HWBP_COUNTER, *PHWBP_COUNTER;
+
+EXTERN_C_START
+
+PHWBP_COUNTER bp_counter_create(void);
+void bp_counter_destroy(PHWBP_COUNTER counter);
+
+// A thread may migrate between reading its processor number and the increment,
+// the increment stays atomic so a shard shared that way is still exact.
+FORCEINLINE void bp_counter_add(PHWBP_COUNTER counter, LONG64 value)
+{
+    InterlockedExchangeAdd64(&counter->shards[GetCurrentProcessorNumber() % HWBP_COUNTER_SHARDS].value, value);
+}
+
+LONG64 bp_counter_read(PHWBP_COUNTER counter);
+
+// Returns the value up to the reset.
+LONG64 bp_counter_reset(PHWBP_COUNTER counter);
+
+EXTERN_C_END
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+
+PHWBP_FILTER bp_filter_create(const HWBP_FILTER_CONDITION *conditions, DWORD count, BOOL aggregate, BOOL deliver)
+{
+    if (count > HWBP_FILTER_CONDITIONS)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        if (conditions[i].field > FILTER_REGISTER || conditions[i].cmp > FILTER_GE ||
+            (conditions[i].field == FILTER_REGISTER && conditions[i].reg > 15))
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return NULL;
+        }
+    }
+
+    PHWBP_FILTER filter = (PHWBP_FILTER)calloc(1, sizeof(HWBP_FILTER));
+    if (!filter)
+        return NULL;
+
+    memcpy(filter->conditions, conditions, count * sizeof(HWBP_FILTER_CONDITION));
+    filter->count = count;
+    filter->aggregate = aggregate;
+    filter->deliver = deliver;
+
+    return filter;
+}
+
+void bp_filter_destroy(PHWBP_FILTER filter)
+{
+    free(filter);
+}
+
+static DWORD64 filter_value(PHWBP bp)
+{
+    switch (bp->length)
+    {
+    case ONE_BYTE:
+        return *(const volatile BYTE *)bp->target;
+    case TWO_BYTE:
+        return *(const volatile WORD *)bp->target;
+    case FOUR_BYTE:
+        return *(const volatile DWORD *)bp->target;
+    default:
+        return *(const volatile DWORD64 *)bp->target;
+    }
+}
+
+static DWORD64 filter_field(const HWBP_FILTER_CONDITION *condition, PHWBP bp, PCONTEXT ctx)
+{
+    switch (condition->field)
+    {
+    case FILTER_THREAD:
+        return GetCurrentThreadId();
+    case FILTER_IP:
+        return ctx->Rip;
+    case FILTER_VALUE:
+        // an execution breakpoint's target is code, its value is still readable
+        return filter_value(bp);
+    default:
+        return (&ctx->Rax)[condition->reg];
+    }
+}
+
+static BOOL filter_match(const HWBP_FILTER_CONDITION *condition, DWORD64 field)
+{
+    if (condition->mask)
+        field &= condition->mask;
+
+    switch (condition->cmp)
+    {
+    case FILTER_EQ:
+        return field == condition->value;
+    case FILTER_NE:
+        return field != condition->value;
+    case FILTER_LT:
+        return field < condition->value;
+    case FILTER_LE:
+        return field <= condition->value;
+    case FILTER_GT:
+        return field > condition->value;
+    default:
+        return field >= condition->value;
+    }
+}
+
+static void filter_count(PHWBP_FILTER filter, DWORD64 ip)
+{
+    DWORD slot = (DWORD)((ip * 0x9e3779b97f4a7c15ull) >> 32) & (HWBP_FILTER_MAP_SIZE - 1);
+
+    for (DWORD probe = 0; probe < HWBP_FILTER_PROBES; probe++)
+    {
+        PHWBP_FILTER_ENTRY entry = &filter->map[(slot + probe) & (HWBP_FILTER_MAP_SIZE - 1)];
+        LONG64 key = entry->ip;
+
+        // claim a free entry, or find that another thread just claimed it for the same ip
+        if (!key)
+            key = InterlockedCompareExchange64(&entry->ip, (LONG64)ip, 0) ? entry->ip : (LONG64)ip;
+
+        if (key == (LONG64)ip)
+        {
+            InterlockedIncrement64(&entry->count);
+            return;
+        }
+    }
+
+    InterlockedIncrement64(&filter->overflow);
+}
+
+BOOL bp_filter_run(PHWBP_FILTER filter, PHWBP bp, PCONTEXT ctx)
+{
+    for (DWORD i = 0; i < filter->count; i++)
+    {
+        if (!filter_match(&filter->conditions[i], filter_field(&filter->conditions[i], bp, ctx)))
+        {
+            InterlockedIncrement64(&filter->dropped);
+            return FALSE;
+        }
+    }
+
+    InterlockedIncrement64(&filter->passed);
+
+    if (filter->aggregate)
+        filter_count(filter, ctx->Rip);
+
+    return filter->deliver;
+}
+
+static int filter_compare(const void *a, const void *b)
+{
+    const HWBP_FILTER_ENTRY *x = (const HWBP_FILTER_ENTRY *)a, *y = (const HWBP_FILTER_ENTRY *)b;
+
+    if (x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+
+    return 0;
+}
+
+DWORD bp_filter_read(PHWBP_FILTER filter, PHWBP_FILTER_ENTRY entries, DWORD max)
+{
+    PHWBP_FILTER_ENTRY all = (PHWBP_FILTER_ENTRY)malloc(sizeof(filter->map));
+    DWORD count = 0;
+
+    if (!all)
+        return 0;
+
+    for (DWORD i = 0; i < HWBP_FILTER_MAP_SIZE; i++)
+    {
+        if (!filter->map[i].ip)
+            continue;
+
+        all[count].ip = filter->map[i].ip;
+        all[count].count = filter->map[i].count;
+        count++;
+    }
+
+    qsort(all, count, sizeof(HWBP_FILTER_ENTRY), filter_compare);
+
+    count = min(count, max);
+    memcpy(entries, all, count * sizeof(HWBP_FILTER_ENTRY));
+    free(all);
+
+    return count;
+}
+
+// Counts racing with the reset may be lost.
+void bp_filter_reset(PHWBP_FILTER filter)
+{
+    for (DWORD i = 0; i < HWBP_FILTER_MAP_SIZE; i++)
+    {
+        filter->map[i].count = 0;
+        filter->map[i].ip = 0;
+    }
+
+    filter->passed = 0;
+    filter->dropped = 0;
+    filter->overflow = 0;
+}
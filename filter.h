@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Filtering and aggregation run inside the exception handler, before a hit is handed to
+// the counter or callback. For a hot watch the delivery is the dominant cost; a filter
+// drops uninteresting hits there and can count the remaining ones per instruction
+// pointer in a lock-free map instead of delivering them at all.
+//
+// A filter is a list of conditions that must all hold, each comparing one field of the
+// hit (thread, instruction pointer, a general purpose register or the watched value)
+// masked with mask against an immediate. The list is checked when the filter is created
+// and runs in bounded time without allocating.
+
+#define HWBP_FILTER_CONDITIONS 8
+#define HWBP_FILTER_MAP_SIZE 1024 // distinct IPs counted, a power of two
+#define HWBP_FILTER_PROBES 16
+
+typedef enum
+{
+    FILTER_THREAD,
+    FILTER_IP,
+    FILTER_VALUE, // the watched location, bp->length bytes, after the access
+    FILTER_REGISTER // reg: 0-15 in CONTEXT order, Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi, R8-R15
+} HWBP_FILTER_FIELD;
+
+typedef enum
+{
+    FILTER_EQ,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE
+} HWBP_FILTER_CMP;
+
+typedef struct _HWBP_FILTER_CONDITION
+{
+    HWBP_FILTER_FIELD field;
+    DWORD reg;
+    HWBP_FILTER_CMP cmp;
+    DWORD64 mask; // 0 means all bits
+    DWORD64 value;
+} HWBP_FILTER_CONDITION, *PHWBP_FILTER_CONDITION;
+
+typedef struct _HWBP_FILTER_ENTRY
+{
+    volatile LONG64 ip; // 0 when free
+    volatile LONG64 count;
+} HWBP_FILTER_ENTRY, *PHWBP_FILTER_ENTRY;
+
+typedef struct _HWBP_FILTER
+{
+    HWBP_FILTER_CONDITION conditions[HWBP_FILTER_CONDITIONS];
+    DWORD count;
+    BOOL aggregate; // count passing hits per IP
+    BOOL deliver;   // hand passing hits on to the counter and callback
+    volatile LONG64 passed;
+    volatile LONG64 dropped;
+    volatile LONG64 overflow; // passing hits whose IP found no room in the map
+    HWBP_FILTER_ENTRY map[HWBP_FILTER_MAP_SIZE];
+} HWBP_FILTER, *PHWBP_FILTER;
+
+EXTERN_C_START
+
+// NULL with ERROR_INVALID_PARAMETER for a condition that does not check out.
+PHWBP_FILTER bp_filter_create(const HWBP_FILTER_CONDITION *conditions, DWORD count, BOOL aggregate, BOOL deliver);
+void bp_filter_destroy(PHWBP_FILTER filter);
+
+// Called by the exception handler. TRUE when the hit is to be delivered.
+BOOL bp_filter_run(PHWBP_FILTER filter, PHWBP bp, PCONTEXT ctx);
+
+// Copies up to max map entries, most hit first. Returns the number copied.
+DWORD bp_filter_read(PHWBP_FILTER filter, PHWBP_FILTER_ENTRY entries, DWORD max);
+void bp_filter_reset(PHWBP_FILTER filter);
+
+EXTERN_C_END
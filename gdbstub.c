@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gdbstub.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#define EFLAGS_TF 0x100
+#define DR6_BS 0x4000
+
+// the single-step handler has no parameter, one stub per process
+static PHWBP_GDBSTUB g_stub = NULL;
+
+static const char g_hex[] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static DWORD64 parse_hex(const char **p)
+{
+    DWORD64 value = 0;
+    int digit;
+
+    while ((digit = hex_value(**p)) != -1)
+    {
+        value = value << 4 | (DWORD64)digit;
+        (*p)++;
+    }
+
+    return value;
+}
+
+// little endian, as gdb expects register contents
+static char *put_hex_le(char *out, const void *data, SIZE_T size)
+{
+    const BYTE *bytes = (const BYTE *)data;
+
+    for (SIZE_T i = 0; i < size; i++)
+    {
+        *out++ = g_hex[bytes[i] >> 4];
+        *out++ = g_hex[bytes[i] & 0xf];
+    }
+
+    return out;
+}
+
+static BOOL client_wait(SOCKET s, DWORD milliseconds)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(s, &set);
+
+    struct timeval timeout = {(long)(milliseconds / 1000), (long)(milliseconds % 1000) * 1000};
+
+    return select(0, &set, NULL, NULL, &timeout) > 0;
+}
+
+// -1 on disconnect, -2 on timeout
+static int read_byte(PHWBP_GDBSTUB stub, DWORD milliseconds)
+{
+    char c;
+
+    if (milliseconds != INFINITE && !client_wait(stub->client, milliseconds))
+        return -2;
+
+    if (recv(stub->client, &c, 1, 0) != 1)
+        return -1;
+
+    return (unsigned char)c;
+}
+
+static BOOL send_packet(PHWBP_GDBSTUB stub, const char *data)
+{
+    SIZE_T len = strlen(data);
+    char *frame = (char *)malloc(len + 4);
+    BYTE sum = 0;
+
+    if (!frame)
+        return FALSE;
+
+    frame[0] = '$';
+    for (SIZE_T i = 0; i < len; i++)
+    {
+        frame[i + 1] = data[i];
+        sum += (BYTE)data[i];
+    }
+    frame[len + 1] = '#';
+    frame[len + 2] = g_hex[sum >> 4];
+    frame[len + 3] = g_hex[sum & 0xf];
+
+    BOOL ok = FALSE;
+    for (int attempt = 0; attempt < 3 && !ok; attempt++)
+    {
+        if (send(stub->client, frame, (int)len + 4, 0) != (int)len + 4)
+            break;
+
+        int ack = read_byte(stub, 5000);
+        ok = ack == '+';
+        if (ack < 0)
+            break;
+    }
+
+    free(frame);
+    return ok;
+}
+
+// Returns the packet length, 0 for an interrupt (0x03), -1 on disconnect.
+static int recv_packet(PHWBP_GDBSTUB stub)
+{
+    for (;;)
+    {
+        int c = read_byte(stub, INFINITE);
+        if (c < 0)
+            return -1;
+        if (c == 0x03)
+            return 0;
+        if (c != '$')
+            continue;
+
+        int len = 0;
+        BYTE sum = 0;
+
+        while ((c = read_byte(stub, INFINITE)) >= 0 && c != '#')
+        {
+            if (len < HWBP_GDBSTUB_PACKET - 1)
+                stub->packet[len++] = (char)c;
+            sum += (BYTE)c;
+        }
+
+        int hi = read_byte(stub, INFINITE), lo = read_byte(stub, INFINITE);
+        if (c < 0 || hi < 0 || lo < 0)
+            return -1;
+
+        stub->packet[len] = '\0';
+
+        if (hex_value((char)hi) << 4 != (sum & 0xf0) || hex_value((char)lo) != (sum & 0xf))
+        {
+            send(stub->client, "-", 1, 0);
+            continue;
+        }
+
+        send(stub->client, "+", 1, 0);
+        return len;
+    }
+}
+
+// caller holds parkedLock
+static PHWBP_GDBSTUB_PARKED find_parked(PHWBP_GDBSTUB stub, DWORD threadId)
+{
+    for (PHWBP_GDBSTUB_PARKED parked = stub->parked; parked; parked = parked->next)
+    {
+        if (parked->threadId == threadId)
+            return parked;
+    }
+
+    return NULL;
+}
+
+// A thread has at most one breakpoint per watch, a list can never overflow.
+static void queue_bp(PHWBP *list, PHWBP bp)
+{
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        if (!list[i])
+        {
+            list[i] = bp;
+            return;
+        }
+    }
+}
+
+static BOOL unqueue_bp(PHWBP *list, PHWBP bp)
+{
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        if (list[i] == bp)
+        {
+            list[i] = NULL;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Runs on the thread that hit: parks it until gdb resumes it.
+static void stop_thread(PHWBP_GDBSTUB stub, PHWBP bp, PCONTEXT ctx)
+{
+    HWBP_GDBSTUB_PARKED parked = {0};
+    parked.threadId = GetCurrentThreadId();
+
+    AcquireSRWLockExclusive(&stub->parkedLock);
+    parked.next = stub->parked;
+    stub->parked = &parked;
+    ReleaseSRWLockExclusive(&stub->parkedLock);
+
+    AcquireSRWLockExclusive(&stub->stopLock);
+
+    if (stub->client != INVALID_SOCKET && !stub->stopping)
+    {
+        stub->stoppedCtx = ctx;
+        stub->stoppedBp = bp;
+        stub->stoppedThread = GetCurrentThreadId();
+
+        SetEvent(stub->hStopped);
+        WaitForSingleObject(stub->hResume, INFINITE);
+
+        if (stub->step)
+        {
+            ctx->EFlags |= EFLAGS_TF;
+            stub->steppingThread = GetCurrentThreadId();
+        }
+    }
+
+    ReleaseSRWLockExclusive(&stub->stopLock);
+
+    // apply what gdb changed while we were parked to the context we resume with
+    AcquireSRWLockExclusive(&stub->parkedLock);
+
+    for (PHWBP_GDBSTUB_PARKED *link = &stub->parked; *link; link = &(*link)->next)
+    {
+        if (*link == &parked)
+        {
+            *link = parked.next;
+            break;
+        }
+    }
+
+    // bp_destroy takes locks, frees and waits for handlers, none of which may happen in
+    // a callback; the server thread destroys these
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        if (parked.disable[i])
+        {
+            bp_disable_ctx(parked.disable[i], ctx);
+            stub->retired[stub->retiredCount++] = parked.disable[i];
+            stub->retiring--;
+        }
+    }
+
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        if (parked.enable[i])
+            bp_enable_ctx(parked.enable[i], ctx);
+    }
+
+    ReleaseSRWLockExclusive(&stub->parkedLock);
+}
+
+static void stub_hit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    stop_thread((PHWBP_GDBSTUB)param, bp, ctx);
+}
+
+// The trap after a single step carries BS rather than a B0-B3 bit, so the library's
+// handler passes it on to this one.
+static LONG CALLBACK stub_step_handler(PEXCEPTION_POINTERS info)
+{
+    PHWBP_GDBSTUB stub = g_stub;
+    PCONTEXT ctx = info->ContextRecord;
+
+    if (!stub || info->ExceptionRecord->ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return EXCEPTION_CONTINUE_SEARCH;
+    if (stub->steppingThread != GetCurrentThreadId() || !(ctx->Dr6 & DR6_BS))
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    stub->steppingThread = 0;
+    ctx->EFlags &= ~EFLAGS_TF;
+    ctx->Dr6 = 0;
+
+    stop_thread(stub, NULL, ctx);
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+static void resume_stopped(PHWBP_GDBSTUB stub, BOOL step)
+{
+    if (!stub->stoppedThread)
+        return;
+
+    stub->step = step;
+    stub->stoppedThread = 0;
+    stub->stoppedCtx = NULL;
+    SetEvent(stub->hResume);
+}
+
+// Every thread of the process but the stub's own, caller frees.
+static DWORD *list_threads(PHWBP_GDBSTUB stub, DWORD *count)
+{
+    DWORD n = 0;
+    DWORD *ids = bp_list_threads(count);
+
+    for (DWORD i = 0; ids && i < *count; i++)
+    {
+        if (ids[i] != stub->serverThreadId)
+            ids[n++] = ids[i];
+    }
+
+    *count = n;
+    return ids;
+}
+
+// caller holds parkedLock
+static BOOL reserve_retired(PHWBP_GDBSTUB stub, DWORD count)
+{
+    DWORD needed = stub->retiredCount + stub->retiring + count;
+
+    if (needed <= stub->retiredCapacity)
+        return TRUE;
+
+    PHWBP *retired = (PHWBP *)realloc(stub->retired, needed * sizeof(PHWBP));
+    if (!retired)
+        return FALSE;
+
+    stub->retired = retired;
+    stub->retiredCapacity = needed;
+
+    return TRUE;
+}
+
+// Destroys the breakpoints parked threads have retired. Server thread only.
+static void destroy_retired(PHWBP_GDBSTUB stub)
+{
+    AcquireSRWLockExclusive(&stub->parkedLock);
+
+    DWORD count = stub->retiredCount;
+    PHWBP *dead = count ? (PHWBP *)malloc(count * sizeof(PHWBP)) : NULL;
+
+    if (dead)
+    {
+        memcpy(dead, stub->retired, count * sizeof(PHWBP));
+        stub->retiredCount = 0;
+    }
+
+    ReleaseSRWLockExclusive(&stub->parkedLock);
+
+    // outside the lock, bp_destroy waits for the retiring thread to leave its handler
+    for (DWORD i = 0; dead && i < count; i++)
+        bp_destroy(dead[i]);
+
+    free(dead);
+}
+
+static void release_watch(PHWBP_GDBSTUB_WATCH watch)
+{
+    for (DWORD i = 0; i < watch->count; i++)
+        bp_destroy(watch->bps[i]);
+
+    free(watch->bps);
+    memset(watch, 0, sizeof(*watch));
+}
+
+static BOOL insert_watch(PHWBP_GDBSTUB stub, char type, DWORD64 address, DWORD kind)
+{
+    BP_READ_WRITE read_write = type == '1' ? INSTRUCTION_EXECUTION : type == '2' ? DATA_WRITEONLY : DATA_READWRITE;
+    BP_LENGTH length;
+
+    // Z1 kind is the breakpoint size in bytes of the architecture, not a watch length
+    switch (type == '1' ? 1 : kind)
+    {
+    case 1:
+        length = ONE_BYTE;
+        break;
+    case 2:
+        length = TWO_BYTE;
+        break;
+    case 4:
+        length = FOUR_BYTE;
+        break;
+    case 8:
+        length = EIGHT_BYTE;
+        break;
+    default:
+        return FALSE;
+    }
+
+    if (type != '1' && address % kind)
+        return FALSE;
+
+    PHWBP_GDBSTUB_WATCH free_watch = NULL;
+
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        PHWBP_GDBSTUB_WATCH watch = &stub->watches[i];
+
+        if (watch->type == type && watch->address == address)
+            return TRUE;
+        if (!watch->type && !free_watch)
+            free_watch = watch;
+    }
+
+    if (!free_watch)
+        return FALSE;
+
+    DWORD count;
+    DWORD *threads = list_threads(stub, &count);
+    if (!threads)
+        return FALSE;
+
+    PHWBP_GDBSTUB_WATCH watch = free_watch;
+    watch->bps = (PHWBP *)calloc(count, sizeof(PHWBP));
+    BOOL ok = watch->bps != NULL;
+
+    for (DWORD i = 0; ok && i < count; i++)
+    {
+        watch->bps[i] = bp_create((LPVOID)address, threads[i], read_write, length);
+        ok = watch->bps[i] && bp_set_callback(watch->bps[i], stub_hit, stub);
+        if (watch->bps[i])
+            watch->count++;
+    }
+
+    free(threads);
+
+    // a debug register on every running thread or none at all, parked threads get theirs
+    // when they resume
+    PHWBP *live = ok ? (PHWBP *)calloc(watch->count, sizeof(PHWBP)) : NULL;
+    DWORD nlive = 0;
+    ok = live != NULL;
+
+    AcquireSRWLockExclusive(&stub->parkedLock);
+
+    for (DWORD i = 0; ok && i < watch->count; i++)
+    {
+        PHWBP_GDBSTUB_PARKED parked = find_parked(stub, watch->bps[i]->threadId);
+
+        if (parked)
+            queue_bp(parked->enable, watch->bps[i]);
+        else
+            live[nlive++] = watch->bps[i];
+    }
+
+    if (ok && nlive && !bp_enable_batch(live, nlive))
+    {
+        for (DWORD i = 0; i < watch->count; i++)
+        {
+            PHWBP_GDBSTUB_PARKED parked = find_parked(stub, watch->bps[i]->threadId);
+            if (parked)
+                unqueue_bp(parked->enable, watch->bps[i]);
+        }
+        ok = FALSE;
+    }
+
+    ReleaseSRWLockExclusive(&stub->parkedLock);
+    free(live);
+
+    if (!ok)
+    {
+        release_watch(watch);
+        return FALSE;
+    }
+
+    watch->type = type;
+    watch->address = address;
+    watch->length = kind;
+
+    return TRUE;
+}
+
+static BOOL remove_watch(PHWBP_GDBSTUB stub, char type, DWORD64 address)
+{
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        PHWBP_GDBSTUB_WATCH watch = &stub->watches[i];
+
+        if (watch->type != type || watch->address != address)
+            continue;
+
+        DWORD nlive = 0;
+
+        AcquireSRWLockExclusive(&stub->parkedLock);
+
+        if (!reserve_retired(stub, watch->count))
+        {
+            ReleaseSRWLockExclusive(&stub->parkedLock);
+            return FALSE;
+        }
+
+        // keep the running threads' breakpoints at the front of bps, a parked thread
+        // disables and retires its own when it resumes unless it never armed it
+        for (DWORD j = 0; j < watch->count; j++)
+        {
+            PHWBP bp = watch->bps[j];
+            PHWBP_GDBSTUB_PARKED parked = find_parked(stub, bp->threadId);
+
+            if (parked && !unqueue_bp(parked->enable, bp))
+            {
+                queue_bp(parked->disable, bp);
+                stub->retiring++;
+            }
+            else
+            {
+                watch->bps[nlive++] = bp;
+            }
+        }
+
+        watch->count = nlive;
+        bp_disable_batch(watch->bps, watch->count);
+
+        ReleaseSRWLockExclusive(&stub->parkedLock);
+
+        release_watch(watch);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void reply_stop(PHWBP_GDBSTUB stub)
+{
+    char reply[96];
+    PHWBP bp = stub->stoppedBp;
+    const char *kind = "hwbreak";
+
+    if (bp && bp->read_write == DATA_WRITEONLY)
+        kind = "watch";
+    else if (bp && bp->read_write == DATA_READWRITE)
+        kind = "awatch";
+
+    if (bp && bp->read_write != INSTRUCTION_EXECUTION)
+        sprintf_s(reply, sizeof(reply), "T05%s:%llx;thread:%lx;", kind, (DWORD64)bp->target, stub->stoppedThread);
+    else if (bp)
+        sprintf_s(reply, sizeof(reply), "T05hwbreak:;thread:%lx;", stub->stoppedThread);
+    else
+        sprintf_s(reply, sizeof(reply), "T05thread:%lx;", stub->stoppedThread);
+
+    stub->selectedThread = stub->stoppedThread;
+    send_packet(stub, reply);
+}
+
+// Waits for a stop, or for gdb to interrupt. FALSE on disconnect.
+static BOOL wait_for_stop(PHWBP_GDBSTUB stub)
+{
+    for (;;)
+    {
+        if (WaitForSingleObject(stub->hStopped, 50) == WAIT_OBJECT_0)
+        {
+            reply_stop(stub);
+            return TRUE;
+        }
+
+        int c = read_byte(stub, 0);
+        if (c == -1)
+            return FALSE;
+
+        if (c == 0x03)
+        {
+            // nothing is actually stopped, gdb gets the prompt back
+            char reply[32];
+            sprintf_s(reply, sizeof(reply), "T02thread:%lx;", stub->selectedThread);
+            send_packet(stub, reply);
+            return TRUE;
+        }
+    }
+}
+
+static void reply_registers(PHWBP_GDBSTUB stub)
+{
+    CONTEXT ctx = {0};
+    char reply[(17 * 8 + 7 * 4) * 2 + 1];
+
+    if (stub->stoppedThread && stub->selectedThread == stub->stoppedThread)
+    {
+        ctx = *stub->stoppedCtx;
+    }
+    else
+    {
+        // a running thread, snapshot it as briefly as possible
+        HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, stub->selectedThread);
+        BOOL ok = hThread && SuspendThread(hThread) != (DWORD)-1;
+
+        if (ok)
+        {
+            ctx.ContextFlags = CONTEXT_FULL;
+            ok = GetThreadContext(hThread, &ctx);
+            ResumeThread(hThread);
+        }
+
+        if (hThread)
+            CloseHandle(hThread);
+
+        if (!ok)
+        {
+            send_packet(stub, "E01");
+            return;
+        }
+    }
+
+    // gdb's amd64 'g' layout: the integer registers, rip, eflags and the segment selectors
+    DWORD64 gpr[17] = {ctx.Rax, ctx.Rbx, ctx.Rcx, ctx.Rdx, ctx.Rsi, ctx.Rdi, ctx.Rbp, ctx.Rsp,
+                       ctx.R8, ctx.R9, ctx.R10, ctx.R11, ctx.R12, ctx.R13, ctx.R14, ctx.R15, ctx.Rip};
+    DWORD seg[7] = {ctx.EFlags, ctx.SegCs, ctx.SegSs, ctx.SegDs, ctx.SegEs, ctx.SegFs, ctx.SegGs};
+
+    char *out = put_hex_le(reply, gpr, sizeof(gpr));
+    out = put_hex_le(out, seg, sizeof(seg));
+    *out = '\0';
+
+    send_packet(stub, reply);
+}
+
+static void reply_memory(PHWBP_GDBSTUB stub, const char *args)
+{
+    DWORD64 address = parse_hex(&args);
+    SIZE_T length = *args == ',' ? (args++, (SIZE_T)parse_hex(&args)) : 0;
+    BYTE buffer[(HWBP_GDBSTUB_PACKET - 1) / 2];
+    char reply[HWBP_GDBSTUB_PACKET];
+
+    length = min(length, sizeof(buffer));
+
+    // unreadable memory fails the read instead of faulting the stub
+    SIZE_T read = 0;
+    if (!ReadProcessMemory(GetCurrentProcess(), (LPCVOID)address, buffer, length, &read) && !read)
+    {
+        send_packet(stub, "E14");
+        return;
+    }
+
+    *put_hex_le(reply, buffer, read) = '\0';
+    send_packet(stub, reply);
+}
+
+static void reply_threads(PHWBP_GDBSTUB stub)
+{
+    DWORD count;
+    DWORD *threads = list_threads(stub, &count);
+    char reply[HWBP_GDBSTUB_PACKET] = "m";
+    SIZE_T used = 1;
+
+    for (DWORD i = 0; threads && i < count && used + 10 < sizeof(reply); i++)
+        used += sprintf_s(reply + used, sizeof(reply) - used, i ? ",%lx" : "%lx", threads[i]);
+
+    free(threads);
+    send_packet(stub, used > 1 ? reply : "l");
+}
+
+// Returns FALSE when the session is over.
+static BOOL handle_packet(PHWBP_GDBSTUB stub, int len)
+{
+    const char *p = stub->packet;
+    char reply[64];
+
+    if (len == 0)
+        return TRUE; // interrupt while nothing runs on our behalf
+
+    switch (p[0])
+    {
+    case '?':
+        if (stub->stoppedThread)
+        {
+            reply_stop(stub);
+        }
+        else
+        {
+            sprintf_s(reply, sizeof(reply), "T05thread:%lx;", stub->selectedThread);
+            send_packet(stub, reply);
+        }
+        return TRUE;
+
+    case 'H':
+        if (p[1] && p[2] != '-')
+        {
+            const char *id = p + 2;
+            DWORD threadId = (DWORD)parse_hex(&id);
+            if (threadId)
+                stub->selectedThread = threadId;
+        }
+        send_packet(stub, "OK");
+        return TRUE;
+
+    case 'T':
+        send_packet(stub, "OK");
+        return TRUE;
+
+    case 'g':
+        reply_registers(stub);
+        return TRUE;
+
+    case 'm':
+        reply_memory(stub, p + 1);
+        return TRUE;
+
+    case 'G':
+    case 'P':
+    case 'M':
+    case 'X':
+        // writing memory is how gdb plants software breakpoints
+        send_packet(stub, "E01");
+        return TRUE;
+
+    case 'Z':
+    case 'z':
+    {
+        char type = p[1];
+        const char *args = p + 3;
+        DWORD64 address = parse_hex(&args);
+        DWORD kind = *args == ',' ? (args++, (DWORD)parse_hex(&args)) : 0;
+        BOOL ok;
+
+        if (type != '1' && type != '2' && type != '4')
+            ok = FALSE; // Z0 and Z3 cannot be done with debug registers, don't let gdb emulate them
+        else if (p[0] == 'Z')
+            ok = insert_watch(stub, type, address, kind);
+        else
+            ok = remove_watch(stub, type, address);
+
+        send_packet(stub, ok ? "OK" : "E01");
+        return TRUE;
+    }
+
+    case 'c':
+    case 's':
+        resume_stopped(stub, p[0] == 's');
+        return wait_for_stop(stub);
+
+    case 'D':
+        send_packet(stub, "OK");
+        return FALSE;
+
+    case 'k':
+        return FALSE;
+
+    case 'q':
+        if (!strncmp(p, "qSupported", 10))
+            send_packet(stub, "PacketSize=1000;hwbreak+;swbreak-");
+        else if (!strcmp(p, "qAttached"))
+            send_packet(stub, "1");
+        else if (!strcmp(p, "qC"))
+        {
+            sprintf_s(reply, sizeof(reply), "QC%lx", stub->selectedThread);
+            send_packet(stub, reply);
+        }
+        else if (!strcmp(p, "qfThreadInfo"))
+            reply_threads(stub);
+        else if (!strcmp(p, "qsThreadInfo"))
+            send_packet(stub, "l");
+        else
+            send_packet(stub, "");
+        return TRUE;
+
+    case 'v':
+        if (!strcmp(p, "vCont?"))
+        {
+            send_packet(stub, "vCont;c;C;s;S");
+        }
+        else if (!strncmp(p, "vCont;", 6))
+        {
+            // one action for the one thread that can be stopped
+            resume_stopped(stub, p[6] == 's' || p[6] == 'S');
+            return wait_for_stop(stub);
+        }
+        else
+        {
+            send_packet(stub, "");
+        }
+        return TRUE;
+
+    default:
+        send_packet(stub, "");
+        return TRUE;
+    }
+}
+
+static void end_session(PHWBP_GDBSTUB stub)
+{
+    for (DWORD i = 0; i < HWBP_GDBSTUB_WATCHES; i++)
+    {
+        if (stub->watches[i].type)
+            remove_watch(stub, stub->watches[i].type, stub->watches[i].address);
+    }
+
+    SOCKET client = stub->client;
+    stub->client = INVALID_SOCKET;
+    stub->steppingThread = 0;
+    resume_stopped(stub, FALSE);
+
+    closesocket(client);
+}
+
+static DWORD WINAPI stub_server(LPVOID param)
+{
+    PHWBP_GDBSTUB stub = (PHWBP_GDBSTUB)param;
+
+    while (!stub->stopping)
+    {
+        if (!client_wait(stub->listener, 200))
+            continue;
+
+        SOCKET client = accept(stub->listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+            continue;
+
+        BOOL nodelay = TRUE;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+
+        stub->client = client;
+        stub->selectedThread = 0;
+
+        DWORD count;
+        DWORD *threads = list_threads(stub, &count);
+        if (threads && count)
+            stub->selectedThread = threads[0];
+        free(threads);
+
+        int len;
+        while (!stub->stopping && (len = recv_packet(stub)) >= 0 && handle_packet(stub, len))
+            destroy_retired(stub);
+
+        end_session(stub);
+        destroy_retired(stub);
+    }
+
+    return 0;
+}
+
+PHWBP_GDBSTUB bp_gdbstub_start(USHORT port)
+{
+    WSADATA wsa;
+    if (g_stub || WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return NULL;
+
+    PHWBP_GDBSTUB stub = (PHWBP_GDBSTUB)calloc(1, sizeof(HWBP_GDBSTUB));
+    if (!stub)
+    {
+        WSACleanup();
+        return NULL;
+    }
+
+    InitializeSRWLock(&stub->stopLock);
+    InitializeSRWLock(&stub->parkedLock);
+    stub->client = INVALID_SOCKET;
+    stub->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    stub->hStopped = CreateEventA(NULL, FALSE, FALSE, NULL);
+    stub->hResume = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    BOOL ok = stub->listener != INVALID_SOCKET && stub->hStopped && stub->hResume &&
+              bind(stub->listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+              listen(stub->listener, 1) == 0;
+
+    if (ok)
+    {
+        g_stub = stub;
+        stub->stepHandler = AddVectoredExceptionHandler(1, stub_step_handler);
+        stub->hServer = CreateThread(NULL, 0, stub_server, stub, 0, &stub->serverThreadId);
+        ok = stub->stepHandler && stub->hServer;
+    }
+
+    if (!ok)
+    {
+        stub->stopping = TRUE;
+        bp_gdbstub_stop(stub);
+        return NULL;
+    }
+
+    return stub;
+}
+
+void bp_gdbstub_stop(PHWBP_GDBSTUB stub)
+{
+    InterlockedExchange(&stub->stopping, TRUE);
+
+    if (stub->hServer)
+    {
+        // unblocks a pending recv, the server then ends the session
+        if (stub->client != INVALID_SOCKET)
+            shutdown(stub->client, SD_BOTH);
+
+        WaitForSingleObject(stub->hServer, INFINITE);
+        CloseHandle(stub->hServer);
+    }
+
+    // threads resumed by the end of the session still apply their queued changes
+    for (;;)
+    {
+        AcquireSRWLockShared(&stub->parkedLock);
+        BOOL empty = stub->parked == NULL;
+        ReleaseSRWLockShared(&stub->parkedLock);
+
+        if (empty)
+            break;
+        Sleep(1);
+    }
+
+    destroy_retired(stub);
+    free(stub->retired);
+
+    if (stub->stepHandler)
+        RemoveVectoredExceptionHandler(stub->stepHandler);
+
+    if (stub->listener != INVALID_SOCKET)
+        closesocket(stub->listener);
+    if (stub->hStopped)
+        CloseHandle(stub->hStopped);
+    if (stub->hResume)
+        CloseHandle(stub->hResume);
+
+    if (g_stub == stub)
+        g_stub = NULL;
+
+    free(stub);
+    WSACleanup();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <winsock2.h>
+#include <Windows.h>
+#include "hwbp.h"
+
+// In-process gdb remote serial protocol stub that only offers true hardware
+// breakpoints and watchpoints.
+//
+//   (gdb) target remote localhost:<port>
+//
+// Z1 (hbreak), Z2 (watch) and Z4 (awatch) are mapped to one HWBP per thread of the
+// process, enabled as a batch through the normal slot allocator, so the request either
+// gets a debug register on every thread or fails. Everything that would make gdb fall
+// back to software breakpoints or software watchpoints is refused with an error rather
+// than reported as unsupported: Z0, Z3 (x86 has no read-only watch), memory writes,
+// and watches of an unaligned or unsupported length.
+//
+// Only the thread that hits a watch is stopped, inside its breakpoint callback, until
+// gdb resumes it; the rest of the process keeps running. z/Z while threads are parked
+// there reach those threads when they resume. Threads created after a watch was
+// inserted are not covered by it.
+
+#define HWBP_GDBSTUB_WATCHES 4
+#define HWBP_GDBSTUB_PACKET 4096
+
+typedef struct _HWBP_GDBSTUB_WATCH
+{
+    char type; // '1', '2' or '4', 0 when free
+    DWORD64 address;
+    DWORD length;
+    PHWBP *bps;
+    DWORD count;
+} HWBP_GDBSTUB_WATCH, *PHWBP_GDBSTUB_WATCH;
+
+// A thread parked in a callback resumes with the context it was stopped in, which would
+// undo any change written to its live debug registers meanwhile. z/Z changes to its
+// breakpoints are queued here instead and applied to that context on its way out.
+typedef struct _HWBP_GDBSTUB_PARKED
+{
+    DWORD threadId;
+    PHWBP enable[HWBP_GDBSTUB_WATCHES];
+    PHWBP disable[HWBP_GDBSTUB_WATCHES]; // retired once disabled
+    struct _HWBP_GDBSTUB_PARKED *next;
+} HWBP_GDBSTUB_PARKED, *PHWBP_GDBSTUB_PARKED;
+
+typedef struct _HWBP_GDBSTUB
+{
+    SOCKET listener;
+    SOCKET client;
+    HANDLE hServer;
+    DWORD serverThreadId;
+    volatile LONG stopping;
+    PVOID stepHandler;
+
+    HWBP_GDBSTUB_WATCH watches[HWBP_GDBSTUB_WATCHES];
+    DWORD selectedThread;
+
+    // the thread stopped in a callback, if any
+    SRWLOCK stopLock;
+    HANDLE hStopped;
+    HANDLE hResume;
+    volatile DWORD stoppedThread;
+    PCONTEXT stoppedCtx;
+    PHWBP stoppedBp;
+    volatile DWORD steppingThread;
+    BOOL step;
+
+    // threads inside stop_thread, waiting or stopped
+    SRWLOCK parkedLock;
+    PHWBP_GDBSTUB_PARKED parked;
+
+    // Breakpoints a parked thread disabled on its way out. They are destroyed by the
+    // server thread, never in the callback: room for every one still in a disable list
+    // is reserved before it is queued, so retiring one needs no allocation.
+    PHWBP *retired;
+    DWORD retiredCount;
+    DWORD retiredCapacity;
+    DWORD retiring; // queued in disable lists, not yet retired
+
+    char packet[HWBP_GDBSTUB_PACKET];
+} HWBP_GDBSTUB, *PHWBP_GDBSTUB;
+
+EXTERN_C_START
+
+// Listens on 127.0.0.1:port and serves one gdb connection at a time from its own thread.
+PHWBP_GDBSTUB bp_gdbstub_start(USHORT port);
+void bp_gdbstub_stop(PHWBP_GDBSTUB stub);
+
+EXTERN_C_END
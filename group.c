@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "group.h"
+
+static PHWBP_GROUP g_groups = NULL;
+static SRWLOCK g_groups_lock = SRWLOCK_INIT;
+
+PHWBP_GROUP bp_group_create(LPCSTR name)
+{
+    PHWBP_GROUP group = (PHWBP_GROUP)calloc(1, sizeof(HWBP_GROUP));
+    if (!group)
+        return NULL;
+
+    strncpy_s(group->name, sizeof(group->name), name ? name : "", _TRUNCATE);
+
+    AcquireSRWLockExclusive(&g_groups_lock);
+    group->next = g_groups;
+    g_groups = group;
+    ReleaseSRWLockExclusive(&g_groups_lock);
+
+    return group;
+}
+
+static void group_release_counter(PHWBP_GROUP group, uint8_t i)
+{
+    if (!(group->ownedCounters & (1 << i)))
+        return;
+
+    PHWBP_COUNTER counter = group->members[i]->counter;
+    bp_set_counter(group->members[i], NULL);
+    bp_counter_destroy(counter);
+
+    group->ownedCounters &= ~(1 << i);
+}
+
+void bp_group_destroy(PHWBP_GROUP group)
+{
+    AcquireSRWLockExclusive(&g_groups_lock);
+    for (PHWBP_GROUP *link = &g_groups; *link; link = &(*link)->next)
+    {
+        if (*link == group)
+        {
+            *link = group->next;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_groups_lock);
+
+    for (uint8_t i = 0; i < group->count; i++)
+        group_release_counter(group, i);
+
+    free(group);
+}
+
+BOOL bp_group_add(PHWBP_GROUP group, PHWBP bp)
+{
+    if (group->enabled || group->count == HWBP_GROUP_MAX)
+        return FALSE;
+
+    for (uint8_t i = 0; i < group->count; i++)
+    {
+        if (group->members[i] == bp)
+            return TRUE;
+    }
+
+    if (!bp->counter)
+    {
+        PHWBP_COUNTER counter = bp_counter_create();
+        if (!counter)
+            return FALSE;
+
+        if (!bp_set_counter(bp, counter))
+        {
+            bp_counter_destroy(counter);
+            return FALSE;
+        }
+
+        group->ownedCounters |= 1 << group->count;
+    }
+
+    group->members[group->count++] = bp;
+
+    return TRUE;
+}
+
+BOOL bp_group_remove(PHWBP_GROUP group, PHWBP bp)
+{
+    if (group->enabled)
+        return FALSE;
+
+    for (uint8_t i = 0; i < group->count; i++)
+    {
+        if (group->members[i] != bp)
+            continue;
+
+        group_release_counter(group, i);
+
+        uint8_t last = --group->count;
+        group->members[i] = group->members[last];
+        if (group->ownedCounters & (1 << last))
+            group->ownedCounters = (group->ownedCounters & ~(1 << last)) | (1 << i);
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL bp_group_enable(PHWBP_GROUP group)
+{
+    if (!bp_enable_batch(group->members, group->count))
+        return FALSE;
+
+    if (!group->enabled)
+        QueryPerformanceCounter(&group->enabledSince);
+
+    group->enabled = TRUE;
+
+    return TRUE;
+}
+
+BOOL bp_group_disable(PHWBP_GROUP group)
+{
+    if (!bp_disable_batch(group->members, group->count))
+        return FALSE;
+
+    if (group->enabled)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        group->enabledTicks += now.QuadPart - group->enabledSince.QuadPart;
+    }
+
+    group->enabled = FALSE;
+
+    return TRUE;
+}
+
+BOOL bp_group_read(PHWBP_GROUP group, PHWBP_GROUP_READING reading)
+{
+    HANDLE threads[HWBP_GROUP_MAX];
+    DWORD ids[HWBP_GROUP_MAX];
+    uint8_t nthreads = 0;
+    BOOL ok = TRUE;
+
+    // a disabled group cannot be hit, no need to stop anything
+    for (uint8_t i = 0; group->enabled && i < group->count; i++)
+    {
+        DWORD threadId = group->members[i]->threadId;
+        uint8_t t = 0;
+
+        while (t < nthreads && ids[t] != threadId)
+            t++;
+
+        if (t < nthreads || threadId == GetCurrentThreadId())
+            continue;
+
+        threads[nthreads] = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, threadId);
+        if (!threads[nthreads])
+        {
+            ok = FALSE;
+            break;
+        }
+
+        if (SuspendThread(threads[nthreads]) == (DWORD)-1)
+        {
+            CloseHandle(threads[nthreads]);
+            ok = FALSE;
+            break;
+        }
+
+        // SuspendThread is asynchronous, reading the context waits for it to take effect
+        CONTEXT ctx = {0};
+        ctx.ContextFlags = CONTEXT_CONTROL;
+        GetThreadContext(threads[nthreads], &ctx);
+
+        ids[nthreads++] = threadId;
+    }
+
+    if (ok)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        reading->count = group->count;
+        reading->timeEnabled = group->enabledTicks + (group->enabled ? now.QuadPart - group->enabledSince.QuadPart : 0);
+        reading->timeRunning = reading->timeEnabled;
+
+        for (uint8_t i = 0; i < group->count; i++)
+            reading->values[i] = group->members[i]->counter ? bp_counter_read(group->members[i]->counter) : 0;
+    }
+
+    while (nthreads--)
+    {
+        ResumeThread(threads[nthreads]);
+        CloseHandle(threads[nthreads]);
+    }
+
+    return ok;
+}
+
+void bp_group_scrape(BOOL (*fn)(PHWBP_GROUP group, PHWBP_GROUP_READING reading, LPVOID param), LPVOID param)
+{
+    HWBP_GROUP_READING reading;
+
+    AcquireSRWLockShared(&g_groups_lock);
+
+    for (PHWBP_GROUP group = g_groups; group; group = group->next)
+    {
+        if (bp_group_read(group, &reading) && !fn(group, &reading, param))
+            break;
+    }
+
+    ReleaseSRWLockShared(&g_groups_lock);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Correlated breakpoints (e.g. head and tail of a queue) that are switched on and off
+// together. Members may live on different threads; each thread's share of the group is
+// committed with a single debug register write while all of the threads are suspended.
+
+#define HWBP_GROUP_MAX 16
+
+typedef struct _HWBP_GROUP
+{
+    CHAR name[32];
+    PHWBP members[HWBP_GROUP_MAX];
+    uint8_t count;
+    uint8_t enabled;
+    uint16_t ownedCounters; // members whose counter the group created
+    LONG64 enabledTicks;    // QueryPerformanceCounter ticks spent enabled, excluding the current period
+    LARGE_INTEGER enabledSince;
+    struct _HWBP_GROUP *next;
+} HWBP_GROUP, *PHWBP_GROUP;
+
+// All members' hit counts taken at one instant.
+typedef struct _HWBP_GROUP_READING
+{
+    uint8_t count;
+    LONG64 timeEnabled; // QueryPerformanceCounter ticks
+    LONG64 timeRunning; // debug register slots are never multiplexed, always equal to timeEnabled
+    LONG64 values[HWBP_GROUP_MAX];
+} HWBP_GROUP_READING, *PHWBP_GROUP_READING;
+
+EXTERN_C_START
+
+// name may be NULL, it only labels the group in bp_group_scrape
+PHWBP_GROUP bp_group_create(LPCSTR name);
+void bp_group_destroy(PHWBP_GROUP group);
+
+// Members are added while the group is disabled. A member without a counter gets one
+// owned by the group (released on remove/destroy).
+BOOL bp_group_add(PHWBP_GROUP group, PHWBP bp);
+BOOL bp_group_remove(PHWBP_GROUP group, PHWBP bp);
+
+BOOL bp_group_enable(PHWBP_GROUP group);
+BOOL bp_group_disable(PHWBP_GROUP group);
+
+// Reads every member's counter in one call. While the group is enabled the member threads
+// are suspended for the read, so no member can be hit in between and the values are
+// from the same instant.
+BOOL bp_group_read(PHWBP_GROUP group, PHWBP_GROUP_READING reading);
+
+// Calls fn with a reading of every group in the process, until it returns FALSE.
+// Groups cannot be created or destroyed from fn.
+void bp_group_scrape(BOOL (*fn)(PHWBP_GROUP group, PHWBP_GROUP_READING reading, LPVOID param), LPVOID param);
+
+EXTERN_C_END
@@ -1,6 +1,71 @@
 #include <stdlib.h>
+#include <string.h>
 #include "hwbp.h"
+#include "arbiter.h"
 #include "dr.h"
+#include "filter.h"
+#include <tlhelp32.h>
+
+#pragma comment(lib, "Synchronization.lib") // WaitOnAddress
+
+#define HWBP_MAX_THREADS 1024
+#define EFLAGS_RF 0x10000
+#define THREAD_DEBUG_ACCESS (THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION)
+
+// Which HWBP occupies which debug register slot of which thread, so the exception
+// handler can map a hit back to its breakpoint. Readers (the handler) are lock-free,
+// writers hold g_threads_lock for the whole suspend/get/set/resume sequence.
+//
+// Each entry also caches the debug registers last written to or read from the thread,
+// valid while the arbiter's generation for the thread is unchanged, so toggling a
+// prepared breakpoint needs no GetThreadContext.
+//
+// A breakpoint may only be freed once no handler can still be using it. version is bumped
+// after every slot change and stamped into a breakpoint leaving its slot (retired); the
+// handler counts itself in depth and its outermost frame records the version it started
+// at, so a breakpoint is in use at most by frames that entered before it was retired.
+typedef struct _HWBP_THREAD
+{
+    volatile DWORD threadId;
+    PHWBP volatile slots[4];
+    volatile LONG64 version;
+    volatile LONG depth;    // handler frames on the thread, written by that thread only
+    volatile LONG64 entered; // version when the outermost of them started
+    BOOL shadowValid;
+    LONG shadowGeneration;
+    DWORD64 shadowDr[4];
+    DWORD64 shadowDr7;
+} HWBP_THREAD, *PHWBP_THREAD;
+
+static HWBP_THREAD g_threads[HWBP_MAX_THREADS];
+static SRWLOCK g_threads_lock = SRWLOCK_INIT;
+static PVOID g_handler = NULL;
+static HWBP_ARM_STATS g_arm_stats[2];
+
+#define BP_PENDING_ENABLE 1
+#define BP_PENDING_DISABLE 2
+
+void bp_init(PHWBP bp, LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LENGTH length)
+{
+    bp->target = lpTarget;
+    bp->threadId = threadId;
+    bp->read_write = read_write;
+    bp->length = length;
+    bp->index = -1;
+    bp->enabled = FALSE;
+    bp->prepared = FALSE;
+    bp->wow64 = BP_WOW64_UNKNOWN;
+    bp->retired = 0;
+    bp->hThread = NULL;
+    bp->callback = NULL;
+    bp->param = NULL;
+    bp->counter = NULL;
+    bp->filter = NULL;
+    bp->pending = 0;
+    bp->result = FALSE;
+    bp->submitted.QuadPart = 0;
+    memset(&bp->debounce, 0, sizeof(bp->debounce));
+}
 
 PHWBP bp_create(LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LENGTH length)
 {
@@ -13,44 +78,231 @@ PHWBP bp_create(LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LE
     return bp;
 }
 
-void bp_destroy(PHWBP bp)
+static PHWBP_THREAD thread_lookup(DWORD threadId)
 {
-    free(bp);
+    for (DWORD i = 0; i < HWBP_MAX_THREADS; i++)
+    {
+        PHWBP_THREAD t = &g_threads[(threadId / 4 + i) % HWBP_MAX_THREADS];
+
+        if (t->threadId == threadId)
+            return t;
+        if (t->threadId == 0)
+            return NULL;
+    }
+    return NULL;
 }
 
-static void bp_init(PHWBP bp, LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LENGTH length)
+// The handler of a live thread uses its entry without a lock, so an entry only changes
+// hands once its thread is gone.
+BOOL bp_thread_exited(DWORD threadId)
 {
-    bp->target = lpTarget;
-    bp->threadId = threadId;
-    bp->read_write = read_write;
-    bp->length = length;
-    bp->index = -1;
-    bp->enabled = FALSE;
+    HANDLE hThread = OpenThread(SYNCHRONIZE, FALSE, threadId);
+    if (!hThread)
+        return TRUE;
+
+    BOOL exited = WaitForSingleObject(hThread, 0) == WAIT_OBJECT_0;
+    CloseHandle(hThread);
+
+    return exited;
+}
+
+// caller holds lock_threads
+static PHWBP_THREAD thread_insert(DWORD threadId)
+{
+    PHWBP_THREAD reuse = NULL;
+    DWORD chain = 0;
+
+    for (; chain < HWBP_MAX_THREADS; chain++)
+    {
+        PHWBP_THREAD t = &g_threads[(threadId / 4 + chain) % HWBP_MAX_THREADS];
+
+        if (t->threadId == threadId)
+            return t;
+
+        if (t->threadId == 0)
+        {
+            reuse = t;
+            break;
+        }
+    }
+
+    // entries are never cleared so probe chains stay intact, but an entry without
+    // breakpoints of an exited thread can be handed to another one
+    for (DWORD i = 0; i < chain; i++)
+    {
+        PHWBP_THREAD t = &g_threads[(threadId / 4 + i) % HWBP_MAX_THREADS];
+
+        if (!t->slots[0] && !t->slots[1] && !t->slots[2] && !t->slots[3] && !t->depth && bp_thread_exited(t->threadId))
+        {
+            reuse = t;
+            break;
+        }
+    }
+
+    if (reuse && reuse->threadId != threadId)
+    {
+        reuse->threadId = threadId;
+        reuse->shadowValid = FALSE;
+    }
+
+    return reuse;
+}
+
+// Threads of 32-bit (WOW64) processes keep their debug registers in the WOW64 context.
+// Only their Dr0-Dr3/Dr6/Dr7 are moved in and out of a CONTEXT, so every op below works
+// on both kinds of thread.
+static uint8_t thread_is_wow64(HANDLE hThread)
+{
+    if (hThread == GetCurrentThread())
+        return FALSE;
+
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, GetProcessIdOfThread(hThread));
+    BOOL wow64 = FALSE;
+
+    if (hProcess)
+    {
+        IsWow64Process(hProcess, &wow64);
+        CloseHandle(hProcess);
+    }
+
+    return (uint8_t)wow64;
+}
+
+static BOOL get_debug_context(HANDLE hThread, uint8_t wow64, PCONTEXT ctx)
+{
+    ctx->ContextFlags = CONTEXT_DEBUG_REGISTERS;
+
+    if (!wow64)
+        return GetThreadContext(hThread, ctx);
+
+    WOW64_CONTEXT wctx = {0};
+    wctx.ContextFlags = WOW64_CONTEXT_DEBUG_REGISTERS;
+
+    if (!Wow64GetThreadContext(hThread, &wctx))
+        return FALSE;
+
+    ctx->Dr0 = wctx.Dr0;
+    ctx->Dr1 = wctx.Dr1;
+    ctx->Dr2 = wctx.Dr2;
+    ctx->Dr3 = wctx.Dr3;
+    ctx->Dr6 = wctx.Dr6;
+    ctx->Dr7 = wctx.Dr7;
+
+    return TRUE;
+}
+
+static BOOL set_debug_context(HANDLE hThread, uint8_t wow64, PCONTEXT ctx)
+{
+    ctx->ContextFlags = CONTEXT_DEBUG_REGISTERS;
+
+    if (!wow64)
+        return SetThreadContext(hThread, ctx);
+
+    WOW64_CONTEXT wctx = {0};
+    wctx.ContextFlags = WOW64_CONTEXT_DEBUG_REGISTERS;
+    wctx.Dr0 = (DWORD)ctx->Dr0;
+    wctx.Dr1 = (DWORD)ctx->Dr1;
+    wctx.Dr2 = (DWORD)ctx->Dr2;
+    wctx.Dr3 = (DWORD)ctx->Dr3;
+    wctx.Dr6 = (DWORD)ctx->Dr6;
+    wctx.Dr7 = (DWORD)ctx->Dr7;
+
+    return Wow64SetThreadContext(hThread, &wctx);
+}
+
+// An i386 thread has 32-bit address registers and no 8 byte breakpoint length.
+static BOOL bp_fits_thread(PHWBP bp)
+{
+    if (bp->wow64 == TRUE && ((DWORD64)bp->target > MAXDWORD || bp->length == EIGHT_BYTE))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Debug register updates are serialized within this copy of the library and,
+// through the arbiter, against every other copy in the process.
+static void lock_threads(void)
+{
+    AcquireSRWLockExclusive(&g_threads_lock);
+    bp_arbiter_lock();
+}
+
+static void unlock_threads(void)
+{
+    bp_arbiter_unlock();
+    ReleaseSRWLockExclusive(&g_threads_lock);
+}
+
+// caller holds lock_threads
+static void shadow_store(DWORD threadId, PCONTEXT ctx)
+{
+    PHWBP_THREAD t = thread_insert(threadId);
+    if (!t)
+        return;
+
+    t->shadowGeneration = bp_arbiter_touch(threadId);
+    t->shadowValid = t->shadowGeneration != -1;
+    t->shadowDr[0] = ctx->Dr0;
+    t->shadowDr[1] = ctx->Dr1;
+    t->shadowDr[2] = ctx->Dr2;
+    t->shadowDr[3] = ctx->Dr3;
+    t->shadowDr7 = ctx->Dr7;
+}
+
+// caller holds lock_threads
+static BOOL shadow_load(DWORD threadId, PCONTEXT ctx)
+{
+    PHWBP_THREAD t = thread_lookup(threadId);
+
+    if (!t || !t->shadowValid || t->shadowGeneration != bp_arbiter_generation(threadId))
+        return FALSE;
+
+    ctx->Dr0 = t->shadowDr[0];
+    ctx->Dr1 = t->shadowDr[1];
+    ctx->Dr2 = t->shadowDr[2];
+    ctx->Dr3 = t->shadowDr[3];
+    ctx->Dr7 = t->shadowDr7;
+
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL slot_free(dr7 _dr7, PHWBP_THREAD t, int8_t idx)
+{
+    // prepared breakpoints keep their slot with the enable bit clear
+    if ((_dr7.flags & (1ull << (idx * 2))) || t->slots[idx])
+        return FALSE;
+
+    return bp_arbiter_claim(t->threadId, idx);
 }
 
-static int8_t get_free_index(dr7 _dr7)
+// caller holds lock_threads, the returned slot is claimed in the arbiter
+static int8_t get_free_index(dr7 _dr7, DWORD threadId)
 {
-    if (!_dr7.local_breakpoint_0)
+    PHWBP_THREAD t = thread_insert(threadId);
+
+    if (!t)
+        return -1;
+    if (slot_free(_dr7, t, 0))
         return 0;
-    if (!_dr7.local_breakpoint_1)
+    if (slot_free(_dr7, t, 1))
         return 1;
-    if (!_dr7.local_breakpoint_2)
+    if (slot_free(_dr7, t, 2))
         return 2;
-    if (!_dr7.local_breakpoint_3)
+    if (slot_free(_dr7, t, 3))
         return 3;
-    return -1; // if all are used, return
+    return -1; // if all are used (or reserved by other owners), return
 }
 
-static BOOL bp_add_to_ctx(PHWBP bp, PCONTEXT ctx)
+// DRn and the DR7 fields of slot idx, enabled
+static BOOL encode_slot(PHWBP bp, int8_t idx, PCONTEXT ctx)
 {
     dr7 _dr7;
     _dr7.flags = ctx->Dr7;
 
-    int8_t idx = get_free_index(_dr7);
-
-    if (idx == -1)
-        return FALSE;
-
     switch (idx)
     {
     case 0:
@@ -81,18 +333,17 @@ static BOOL bp_add_to_ctx(PHWBP bp, PCONTEXT ctx)
         return FALSE; // should never happen
     }
 
-    bp->index = idx;
     ctx->Dr7 = _dr7.flags;
 
     return TRUE;
 }
 
-static BOOL bp_remove_from_ctx(PHWBP bp, PCONTEXT ctx)
+static BOOL clear_slot(int8_t idx, PCONTEXT ctx)
 {
     dr7 _dr7;
     _dr7.flags = ctx->Dr7;
 
-    switch (bp->index)
+    switch (idx)
     {
     case 0:
         ctx->Dr0 = 0;
@@ -119,102 +370,1120 @@ static BOOL bp_remove_from_ctx(PHWBP bp, PCONTEXT ctx)
         _dr7.read_write_3 = 0;
         break;
     default:
+        return FALSE;
+    }
+
+    ctx->Dr7 = _dr7.flags;
+
+    return TRUE;
+}
+
+static BOOL bp_add_to_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    dr7 _dr7;
+    _dr7.flags = ctx->Dr7;
+
+    int8_t idx = get_free_index(_dr7, bp->threadId);
+
+    if (idx == -1 || !encode_slot(bp, idx, ctx))
+        return FALSE;
+
+    bp->index = idx;
+
+    return TRUE;
+}
+
+static BOOL bp_remove_from_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    if (!clear_slot(bp->index, ctx))
+    {
         bp->enabled = FALSE;
         return FALSE; // ??
     }
 
     bp->index = -1;
-    ctx->Dr7 = _dr7.flags;
 
     return TRUE;
 }
 
-BOOL bp_enable(PHWBP bp)
+// caller holds lock_threads
+static void bp_track(PHWBP bp, int8_t idx, PHWBP value)
 {
-    HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, bp->threadId);
+    PHWBP_THREAD t = value ? thread_insert(bp->threadId) : thread_lookup(bp->threadId);
 
-    if (!hThread)
+    if (!t)
+        return;
+
+    t->slots[idx] = value;
+
+    // ordered after the slot store, a handler that sees the new version sees the slot
+    LONG64 version = InterlockedIncrement64(&t->version);
+    if (!value)
+        bp->retired = version;
+}
+
+static void set_local_enable(PCONTEXT ctx, int8_t idx, BOOL on)
+{
+    if (on)
+        ctx->Dr7 |= 1ull << (idx * 2);
+    else
+        ctx->Dr7 &= ~(1ull << (idx * 2));
+}
+
+// caller holds lock_threads
+static BOOL bp_enable_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    // already holds a slot (enabled concurrently from another thread), don't take a second one
+    if (bp->index != -1)
+        return TRUE;
+
+    if (!bp_fits_thread(bp) || !bp_add_to_ctx(bp, ctx))
         return FALSE;
 
-    if (SuspendThread(hThread) == (DWORD)-1)
-    {
-        CloseHandle(hThread);
+    bp_track(bp, bp->index, bp);
+    bp->enabled = TRUE;
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL bp_disable_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    int8_t idx = bp->index;
+
+    if (!bp_remove_from_ctx(bp, ctx))
         return FALSE;
-    }
 
-    CONTEXT ctx = {0};
-    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+    bp_arbiter_release(bp->threadId, idx);
+    bp_track(bp, idx, NULL);
+    bp->enabled = FALSE;
+    return TRUE;
+}
 
-    if (!GetThreadContext(hThread, &ctx))
-    {
-        ResumeThread(hThread);
-        CloseHandle(hThread);
+// caller holds lock_threads
+static BOOL bp_prepare_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    if (!bp_enable_in_ctx(bp, ctx))
         return FALSE;
-    }
 
-    if (!bp_add_to_ctx(bp, &ctx))
-    {
-        ResumeThread(hThread);
-        CloseHandle(hThread);
+    set_local_enable(ctx, bp->index, FALSE);
+    bp->enabled = FALSE;
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL bp_arm_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    set_local_enable(ctx, bp->index, TRUE);
+    bp->enabled = TRUE;
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL bp_disarm_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    set_local_enable(ctx, bp->index, FALSE);
+    bp->enabled = FALSE;
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL bp_write_slot(PHWBP bp, PCONTEXT ctx)
+{
+    if (!bp_fits_thread(bp))
         return FALSE;
-    }
 
-    if (!SetThreadContext(hThread, &ctx))
+    dr7 _dr7;
+    _dr7.flags = ctx->Dr7;
+
+    switch (bp->index)
     {
-        ResumeThread(hThread);
-        CloseHandle(hThread);
+    case 0:
+        ctx->Dr0 = (DWORD64)bp->target;
+        _dr7.length_0 = bp->length;
+        break;
+    case 1:
+        ctx->Dr1 = (DWORD64)bp->target;
+        _dr7.length_1 = bp->length;
+        break;
+    case 2:
+        ctx->Dr2 = (DWORD64)bp->target;
+        _dr7.length_2 = bp->length;
+        break;
+    case 3:
+        ctx->Dr3 = (DWORD64)bp->target;
+        _dr7.length_3 = bp->length;
+        break;
+    default:
         return FALSE;
     }
 
-    ResumeThread(hThread);
-    CloseHandle(hThread);
-
-    bp->enabled = TRUE;
+    ctx->Dr7 = _dr7.flags;
 
     return TRUE;
 }
 
-BOOL bp_disable(PHWBP bp)
+// Bookkeeping an op may change, saved so it can be put back exactly.
+typedef struct _HWBP_SAVED
+{
+    int8_t index;
+    uint8_t enabled;
+    uint8_t parked;
+} HWBP_SAVED;
+
+static void bp_save(PHWBP bp, HWBP_SAVED *saved)
+{
+    saved->index = bp->index;
+    saved->enabled = bp->enabled;
+    saved->parked = bp->debounce.parked;
+}
+
+// caller holds lock_threads
+// Reverts an op whose registers could not be written. The hardware still has the old
+// layout, so bp goes back to the very slot it held rather than to any free one.
+static void bp_restore(PHWBP bp, const HWBP_SAVED *saved)
+{
+    if (bp->index != saved->index)
+    {
+        if (bp->index != -1)
+        {
+            bp_arbiter_release(bp->threadId, bp->index);
+            bp_track(bp, bp->index, NULL);
+        }
+
+        // released by this op under the same lock, nobody can have claimed it since
+        if (saved->index != -1)
+        {
+            bp_arbiter_claim(bp->threadId, saved->index);
+            bp_track(bp, saved->index, bp);
+        }
+
+        bp->index = saved->index;
+    }
+
+    bp->enabled = saved->enabled;
+    bp->debounce.parked = saved->parked;
+}
+
+// Suspends the target thread, applies op to its debug registers and resumes it.
+// If the registers cannot be written op's bookkeeping is reverted.
+// The current thread cannot suspend itself, its context is written directly instead.
+static BOOL bp_apply(PHWBP bp, BOOL (*op)(PHWBP, PCONTEXT))
 {
-    HANDLE hThread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, bp->threadId);
+    BOOL self = bp->threadId == GetCurrentThreadId();
+    HANDLE hThread = self ? GetCurrentThread() : OpenThread(THREAD_DEBUG_ACCESS, FALSE, bp->threadId);
 
     if (!hThread)
         return FALSE;
 
-    if (SuspendThread(hThread) == (DWORD)-1)
+    lock_threads();
+
+    if (!self && SuspendThread(hThread) == (DWORD)-1)
     {
+        unlock_threads();
         CloseHandle(hThread);
         return FALSE;
     }
 
+    if (bp->wow64 == BP_WOW64_UNKNOWN)
+        bp->wow64 = thread_is_wow64(hThread);
+
     CONTEXT ctx = {0};
-    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+    HWBP_SAVED saved;
+    bp_save(bp, &saved);
+
+    BOOL ok = get_debug_context(hThread, bp->wow64, &ctx) && op(bp, &ctx);
 
-    if (!GetThreadContext(hThread, &ctx))
+    if (ok && !set_debug_context(hThread, bp->wow64, &ctx))
     {
-        ResumeThread(hThread);
-        CloseHandle(hThread);
-        return FALSE;
+        bp_restore(bp, &saved);
+        ok = FALSE;
     }
 
-    if (!bp_remove_from_ctx(bp, &ctx))
+    if (ok)
+        shadow_store(bp->threadId, &ctx);
+
+    if (!self)
     {
         ResumeThread(hThread);
         CloseHandle(hThread);
-        return FALSE;
     }
 
-    if (!SetThreadContext(hThread, &ctx))
-    {
-        ResumeThread(hThread);
-        CloseHandle(hThread);
+    unlock_threads();
+
+    return ok;
+}
+
+// Applies op with a single SetThreadContext built from the cached debug registers.
+// Debug registers are set through an APC in the target, so the thread need not be
+// suspended and the change is live on return. Falls back to bp_apply when the cache
+// is stale. Only for ops that keep the slot layout (no claim or release).
+static BOOL bp_apply_cached(PHWBP bp, BOOL (*op)(PHWBP, PCONTEXT))
+{
+    CONTEXT ctx = {0};
+    ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+
+    HANDLE hThread = bp->hThread ? bp->hThread : OpenThread(THREAD_SET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION, FALSE, bp->threadId);
+    if (!hThread)
         return FALSE;
+
+    lock_threads();
+
+    // bp may have been armed from its own handler, which never had a real thread handle
+    if (bp->wow64 == BP_WOW64_UNKNOWN)
+        bp->wow64 = thread_is_wow64(hThread);
+
+    BOOL cached = shadow_load(bp->threadId, &ctx);
+    BOOL ok = FALSE;
+    HWBP_SAVED saved;
+    bp_save(bp, &saved);
+
+    if (cached && op(bp, &ctx))
+    {
+        ok = set_debug_context(hThread, bp->wow64, &ctx);
+        if (ok)
+            shadow_store(bp->threadId, &ctx);
+        else
+            bp_restore(bp, &saved);
     }
 
-    ResumeThread(hThread);
-    CloseHandle(hThread);
+    unlock_threads();
 
-    bp->enabled = FALSE;
+    if (hThread != bp->hThread)
+        CloseHandle(hThread);
+
+    if (!cached)
+        return bp_apply(bp, op);
+
+    return ok;
+}
+
+static BOOL bp_toggle(PHWBP bp, BOOL on)
+{
+    return bp_apply_cached(bp, on ? bp_arm_in_ctx : bp_disarm_in_ctx);
+}
+
+BOOL bp_retarget(PHWBP bp, LPVOID newTarget, BP_LENGTH newLength)
+{
+    LPVOID target = bp->target;
+    BP_LENGTH length = bp->length;
+
+    bp->target = newTarget;
+    bp->length = newLength;
+
+    if (bp->index == -1)
+        return TRUE;
+
+    if (bp_apply_cached(bp, bp_write_slot))
+        return TRUE;
+
+    bp->target = target;
+    bp->length = length;
+
+    return FALSE;
+}
+
+BOOL bp_prepare(PHWBP bp)
+{
+    if (bp->prepared || bp->enabled)
+        return FALSE;
+
+    // a real handle even for the calling thread, bp may be toggled from elsewhere
+    bp->hThread = OpenThread(THREAD_SET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION, FALSE, bp->threadId);
+    if (!bp->hThread)
+        return FALSE;
+
+    if (!bp_apply(bp, bp_prepare_in_ctx))
+    {
+        CloseHandle(bp->hThread);
+        bp->hThread = NULL;
+        return FALSE;
+    }
+
+    bp->prepared = TRUE;
+
+    return TRUE;
+}
+
+BOOL bp_unprepare(PHWBP bp)
+{
+    if (!bp->prepared)
+        return FALSE;
+
+    if (!bp_apply(bp, bp_disable_in_ctx))
+        return FALSE;
+
+    CloseHandle(bp->hThread);
+
+    bp->hThread = NULL;
+    bp->prepared = FALSE;
+    bp->enabled = FALSE;
+
+    return TRUE;
+}
+
+static void bp_account(BP_ARM_MODE mode, LARGE_INTEGER start, BOOL caller, BOOL completion)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    if (caller)
+    {
+        InterlockedIncrement64(&g_arm_stats[mode].count);
+        InterlockedExchangeAdd64(&g_arm_stats[mode].callerTicks, now.QuadPart - start.QuadPart);
+    }
+    if (completion)
+        InterlockedExchangeAdd64(&g_arm_stats[mode].completionTicks, now.QuadPart - start.QuadPart);
+}
+
+static BOOL bp_set_state(PHWBP bp, BOOL enable)
+{
+    BOOL ok;
+
+    if (bp->prepared)
+        ok = bp_toggle(bp, enable);
+    else
+        ok = bp_apply(bp, enable ? bp_enable_in_ctx : bp_disable_in_ctx);
+
+    if (!ok)
+        return FALSE;
+
+    bp->enabled = (uint8_t)enable;
+
+    // make the new state visible to every processor, e.g. a callback already running on the target
+    FlushProcessWriteBuffers();
+
+    return TRUE;
+}
+
+typedef struct _HWBP_BATCH_THREAD
+{
+    DWORD threadId;
+    HANDLE hThread;
+    BOOL self;
+    uint8_t wow64;
+    BOOL written;
+    CONTEXT ctx;
+    CONTEXT original;
+} HWBP_BATCH_THREAD, *PHWBP_BATCH_THREAD;
+
+static BOOL (*batch_op(PHWBP bp, BOOL enable))(PHWBP, PCONTEXT)
+{
+    if (bp->prepared)
+        return enable ? bp_arm_in_ctx : bp_disarm_in_ctx;
+    return enable ? bp_enable_in_ctx : bp_disable_in_ctx;
+}
+
+// Suspends every thread involved, computes each thread's new debug registers with
+// all of its members applied, writes each thread once and only then resumes them,
+// so no thread runs with part of the batch applied. On any failure every thread is
+// left as it was.
+static BOOL bp_set_state_batch(PHWBP *bps, DWORD count, BOOL enable)
+{
+    PHWBP_BATCH_THREAD threads = (PHWBP_BATCH_THREAD)calloc(count, sizeof(HWBP_BATCH_THREAD));
+    DWORD *owner = (DWORD *)calloc(count, sizeof(DWORD)); // index into threads per member
+    BOOL *changed = (BOOL *)calloc(count, sizeof(BOOL));
+    HWBP_SAVED *saved = (HWBP_SAVED *)calloc(count, sizeof(HWBP_SAVED));
+    DWORD nthreads = 0, applied = 0;
+    BOOL ok = threads && owner && changed && saved;
+
+    if (!ok)
+    {
+        free(threads);
+        free(owner);
+        free(changed);
+        free(saved);
+        return FALSE;
+    }
+
+    lock_threads();
+
+    for (DWORD i = 0; ok && i < count; i++)
+    {
+        DWORD t = 0;
+        while (t < nthreads && threads[t].threadId != bps[i]->threadId)
+            t++;
+
+        owner[i] = t;
+        if (t < nthreads)
+            continue;
+
+        PHWBP_BATCH_THREAD thread = &threads[nthreads];
+        thread->threadId = bps[i]->threadId;
+        thread->self = thread->threadId == GetCurrentThreadId();
+        thread->hThread = thread->self ? GetCurrentThread() : OpenThread(THREAD_DEBUG_ACCESS, FALSE, thread->threadId);
+
+        if (!thread->hThread)
+        {
+            ok = FALSE;
+            break;
+        }
+
+        if (!thread->self && SuspendThread(thread->hThread) == (DWORD)-1)
+        {
+            CloseHandle(thread->hThread);
+            ok = FALSE;
+            break;
+        }
+
+        nthreads++;
+
+        thread->wow64 = thread_is_wow64(thread->hThread);
+        ok = get_debug_context(thread->hThread, thread->wow64, &thread->ctx);
+        thread->original = thread->ctx;
+    }
+
+    while (ok && applied < count)
+    {
+        PHWBP bp = bps[applied];
+
+        changed[applied] = bp->enabled != enable;
+        bp->wow64 = threads[owner[applied]].wow64;
+        bp_save(bp, &saved[applied]);
+
+        if (changed[applied] && !batch_op(bp, enable)(bp, &threads[owner[applied]].ctx))
+            ok = FALSE;
+        else
+            applied++;
+    }
+
+    for (DWORD t = 0; ok && t < nthreads; t++)
+    {
+        ok = set_debug_context(threads[t].hThread, threads[t].wow64, &threads[t].ctx);
+        threads[t].written = ok;
+    }
+
+    if (!ok)
+    {
+        // put the members applied so far back in the slots they held, newest first
+        for (DWORD i = applied; i-- > 0;)
+        {
+            if (changed[i])
+                bp_restore(bps[i], &saved[i]);
+        }
+
+        for (DWORD t = 0; t < nthreads; t++)
+        {
+            if (threads[t].written)
+                set_debug_context(threads[t].hThread, threads[t].wow64, &threads[t].original);
+        }
+    }
+    else
+    {
+        for (DWORD t = 0; t < nthreads; t++)
+            shadow_store(threads[t].threadId, &threads[t].ctx);
+    }
+
+    for (DWORD t = 0; t < nthreads; t++)
+    {
+        if (!threads[t].self)
+        {
+            ResumeThread(threads[t].hThread);
+            CloseHandle(threads[t].hThread);
+        }
+    }
+
+    unlock_threads();
+
+    free(threads);
+    free(owner);
+    free(changed);
+    free(saved);
+
+    if (ok)
+        FlushProcessWriteBuffers();
+
+    return ok;
+}
+
+BOOL bp_enable_batch(PHWBP *bps, DWORD count)
+{
+    return bp_set_state_batch(bps, count, TRUE);
+}
+
+BOOL bp_disable_batch(PHWBP *bps, DWORD count)
+{
+    return bp_set_state_batch(bps, count, FALSE);
+}
+
+static void CALLBACK bp_async_worker(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+    PHWBP bp = (PHWBP)context;
+    UNREFERENCED_PARAMETER(instance);
+
+    bp->result = bp_set_state(bp, bp->pending == BP_PENDING_ENABLE);
+    bp_account(BP_ASYNC, bp->submitted, FALSE, TRUE);
+
+    InterlockedExchange(&bp->pending, 0);
+    WakeByAddressAll((PVOID)&bp->pending);
+}
+
+static BOOL bp_set_state_ex(PHWBP bp, BOOL enable, BP_ARM_MODE mode)
+{
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    if (mode == BP_SYNC)
+    {
+        BOOL ok = bp_set_state(bp, enable);
+        bp_account(BP_SYNC, start, TRUE, TRUE);
+        return ok;
+    }
+
+    if (InterlockedCompareExchange(&bp->pending, enable ? BP_PENDING_ENABLE : BP_PENDING_DISABLE, 0) != 0)
+    {
+        SetLastError(ERROR_BUSY);
+        return FALSE;
+    }
+
+    bp->submitted = start;
+
+    if (!TrySubmitThreadpoolCallback(bp_async_worker, bp, NULL))
+    {
+        InterlockedExchange(&bp->pending, 0);
+        return FALSE;
+    }
+
+    bp_account(BP_ASYNC, start, TRUE, FALSE);
+
+    return TRUE;
+}
+
+BOOL bp_enable(PHWBP bp)
+{
+    return bp_set_state_ex(bp, TRUE, BP_SYNC);
+}
+
+BOOL bp_disable(PHWBP bp)
+{
+    return bp_set_state_ex(bp, FALSE, BP_SYNC);
+}
+
+BOOL bp_enable_ex(PHWBP bp, BP_ARM_MODE mode)
+{
+    return bp_set_state_ex(bp, TRUE, mode);
+}
+
+BOOL bp_disable_ex(PHWBP bp, BP_ARM_MODE mode)
+{
+    return bp_set_state_ex(bp, FALSE, mode);
+}
+
+BOOL bp_wait(PHWBP bp, DWORD dwMilliseconds)
+{
+    LONG pending;
+
+    while ((pending = bp->pending) != 0)
+    {
+        if (!WaitOnAddress(&bp->pending, &pending, sizeof(pending), dwMilliseconds) && GetLastError() == ERROR_TIMEOUT)
+            return FALSE;
+    }
+
+    return bp->result;
+}
+
+void bp_destroy(PHWBP bp)
+{
+    // never leave a slot pointing at freed memory for the exception handler
+    bp_wait(bp, INFINITE);
+    bp_set_debounce(bp, 0, FALSE);
+
+    if (bp->prepared)
+        bp_unprepare(bp);
+    else if (bp->index != -1)
+        bp_disable(bp);
+
+    // the registers could not be written, most likely because the thread has exited,
+    // drop the slot anyway so neither the table nor the arbiter refers to bp
+    if (bp->index != -1)
+    {
+        lock_threads();
+        bp_arbiter_release(bp->threadId, bp->index);
+        bp_track(bp, bp->index, NULL);
+        bp->index = -1;
+        unlock_threads();
+    }
+
+    bp_drain(bp);
+    free(bp);
+}
+
+void bp_drain(PHWBP bp)
+{
+    // the calling thread's own handler frames are below it on the stack, they re-check
+    // each slot before using the breakpoint in it
+    if (bp->threadId == GetCurrentThreadId())
+        return;
+
+    PHWBP_THREAD t = thread_lookup(bp->threadId);
+
+    for (DWORD spins = 0; t && t->threadId == bp->threadId && t->depth && t->entered < bp->retired; spins++)
+    {
+        if (spins < 64)
+            YieldProcessor();
+        else
+            SwitchToThread();
+    }
+}
+
+void bp_arm_stats(BP_ARM_MODE mode, PHWBP_ARM_STATS stats)
+{
+    stats->count = g_arm_stats[mode].count;
+    stats->callerTicks = g_arm_stats[mode].callerTicks;
+    stats->completionTicks = g_arm_stats[mode].completionTicks;
+}
+
+BOOL bp_enable_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    if (bp->threadId != GetCurrentThreadId())
+        return FALSE;
+
+    // ctx is the calling thread's own context, later cached writes must use the same kind
+    bp->wow64 = thread_is_wow64(GetCurrentThread());
+
+    lock_threads();
+    BOOL ok = bp->prepared ? bp_arm_in_ctx(bp, ctx) : bp_enable_in_ctx(bp, ctx);
+    if (ok)
+        shadow_store(bp->threadId, ctx);
+    unlock_threads();
+
+    if (!ok)
+        return FALSE;
+
+    bp->enabled = TRUE;
+
+    return TRUE;
+}
+
+BOOL bp_disable_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    if (bp->threadId != GetCurrentThreadId())
+        return FALSE;
+
+    // ctx is the calling thread's own context, later cached writes must use the same kind
+    bp->wow64 = thread_is_wow64(GetCurrentThread());
+
+    lock_threads();
+    BOOL ok = bp->prepared ? bp_disarm_in_ctx(bp, ctx) : bp_disable_in_ctx(bp, ctx);
+    if (ok)
+        shadow_store(bp->threadId, ctx);
+    unlock_threads();
+
+    if (!ok)
+        return FALSE;
+
+    bp->enabled = FALSE;
+
+    return TRUE;
+}
+
+static BOOL check_slot(PHWBP_THREAD t, PCONTEXT ctx, int8_t idx)
+{
+    PHWBP bp = t ? t->slots[idx] : NULL;
+    DWORD64 dr[4] = {ctx->Dr0, ctx->Dr1, ctx->Dr2, ctx->Dr3};
+    BOOL local = (ctx->Dr7 >> (idx * 2)) & 1;
+    DWORD64 bits = (ctx->Dr7 >> (16 + idx * 4)) & 0xf;
+    LONG owner = t ? bp_arbiter_slot(t->threadId, idx) : 0;
+
+    if (!bp)
+        return !owner || owner != bp_arbiter_self(); // not ours, nothing to check
+
+    if (bp->index != idx || bp->threadId != t->threadId || dr[idx] != (DWORD64)bp->target)
+        return FALSE;
+    if (bits != ((DWORD64)bp->length << 2 | (DWORD64)bp->read_write))
+        return FALSE;
+    if (local != (bp->debounce.parked ? FALSE : bp->prepared ? bp->enabled : TRUE))
+        return FALSE;
+
+    // no arbiter (owner 0) or held by this copy
+    return !owner || owner == bp_arbiter_self();
+}
+
+BOOL bp_thread_regs(DWORD threadId, PHWBP_REGS regs)
+{
+    HANDLE hThread = OpenThread(THREAD_GET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION, FALSE, threadId);
+    BOOL ok;
+
+    if (!hThread)
+        return FALSE;
+
+    regs->wow64 = thread_is_wow64(hThread);
+
+    if (regs->wow64)
+    {
+        WOW64_CONTEXT wctx = {0};
+        wctx.ContextFlags = WOW64_CONTEXT_CONTROL | WOW64_CONTEXT_INTEGER | WOW64_CONTEXT_DEBUG_REGISTERS;
+
+        ok = Wow64GetThreadContext(hThread, &wctx);
+
+        regs->ip = wctx.Eip;
+        regs->sp = wctx.Esp;
+        regs->fp = wctx.Ebp;
+        regs->flags = wctx.EFlags;
+        regs->dr6 = wctx.Dr6;
+        regs->gpr[0] = wctx.Eax;
+        regs->gpr[1] = wctx.Ecx;
+        regs->gpr[2] = wctx.Edx;
+        regs->gpr[3] = wctx.Ebx;
+        regs->gpr[4] = wctx.Esi;
+        regs->gpr[5] = wctx.Edi;
+    }
+    else
+    {
+        CONTEXT ctx = {0};
+        ctx.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER | CONTEXT_DEBUG_REGISTERS;
+
+        ok = GetThreadContext(hThread, &ctx);
+
+        regs->ip = ctx.Rip;
+        regs->sp = ctx.Rsp;
+        regs->fp = ctx.Rbp;
+        regs->flags = ctx.EFlags;
+        regs->dr6 = ctx.Dr6;
+        regs->gpr[0] = ctx.Rax;
+        regs->gpr[1] = ctx.Rcx;
+        regs->gpr[2] = ctx.Rdx;
+        regs->gpr[3] = ctx.Rbx;
+        regs->gpr[4] = ctx.Rsi;
+        regs->gpr[5] = ctx.Rdi;
+    }
+
+    CloseHandle(hThread);
+
+    return ok;
+}
+
+BOOL bp_encode_slot(PHWBP bp, int8_t idx, PCONTEXT ctx)
+{
+    return bp_fits_thread(bp) && encode_slot(bp, idx, ctx);
+}
+
+void bp_clear_slot(int8_t idx, PCONTEXT ctx)
+{
+    clear_slot(idx, ctx);
+}
+
+BOOL bp_get_debug_regs(HANDLE hThread, BOOL wow64, PCONTEXT ctx)
+{
+    return get_debug_context(hThread, (uint8_t)wow64, ctx);
+}
+
+BOOL bp_set_debug_regs(HANDLE hThread, BOOL wow64, PCONTEXT ctx)
+{
+    return set_debug_context(hThread, (uint8_t)wow64, ctx);
+}
+
+DWORD *bp_list_threads(DWORD *count)
+{
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    DWORD capacity = 64, n = 0;
+    DWORD *ids = (DWORD *)malloc(capacity * sizeof(DWORD));
+
+    if (hSnapshot == INVALID_HANDLE_VALUE || !ids)
+    {
+        if (hSnapshot != INVALID_HANDLE_VALUE)
+            CloseHandle(hSnapshot);
+        free(ids);
+        return NULL;
+    }
+
+    THREADENTRY32 entry = {0};
+    entry.dwSize = sizeof(entry);
+
+    for (BOOL more = Thread32First(hSnapshot, &entry); more; more = Thread32Next(hSnapshot, &entry))
+    {
+        if (entry.th32OwnerProcessID != GetCurrentProcessId())
+            continue;
+
+        if (n == capacity)
+        {
+            DWORD *grown = (DWORD *)realloc(ids, (capacity *= 2) * sizeof(DWORD));
+            if (!grown)
+                break;
+            ids = grown;
+        }
+
+        ids[n++] = entry.th32ThreadID;
+    }
+
+    CloseHandle(hSnapshot);
+
+    *count = n;
+    return ids;
+}
+
+BOOL bp_check_thread(DWORD threadId)
+{
+    BOOL self = threadId == GetCurrentThreadId();
+    HANDLE hThread = self ? GetCurrentThread() : OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION, FALSE, threadId);
+
+    if (!hThread)
+        return FALSE;
+
+    // under the lock no update of ours is half way through
+    lock_threads();
+
+    if (!self && SuspendThread(hThread) == (DWORD)-1)
+    {
+        unlock_threads();
+        CloseHandle(hThread);
+        return FALSE;
+    }
+
+    CONTEXT ctx = {0};
+    BOOL read = get_debug_context(hThread, thread_is_wow64(hThread), &ctx);
+    BOOL ok = read;
+
+    if (read)
+    {
+        PHWBP_THREAD t = thread_lookup(threadId);
+
+        for (int8_t i = 0; ok && i < 4; i++)
+            ok = check_slot(t, &ctx, i);
+    }
+
+    if (!self)
+    {
+        ResumeThread(hThread);
+        CloseHandle(hThread);
+    }
+
+    unlock_threads();
+
+    if (read && !ok)
+        SetLastError(ERROR_INVALID_DATA);
+
+    return ok;
+}
+
+// caller holds lock_threads
+static BOOL bp_park_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    set_local_enable(ctx, bp->index, FALSE);
+    bp->debounce.parked = TRUE;
+    return TRUE;
+}
+
+// caller holds lock_threads
+static BOOL bp_unpark_in_ctx(PHWBP bp, PCONTEXT ctx)
+{
+    // disabled meanwhile, the slot stays (or is already) off
+    if (bp->debounce.parked && bp->index != -1 && bp->enabled)
+        set_local_enable(ctx, bp->index, TRUE);
+
+    bp->debounce.parked = FALSE;
+    return TRUE;
+}
+
+static void CALLBACK debounce_timer(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer)
+{
+    PHWBP bp = (PHWBP)context;
+    UNREFERENCED_PARAMETER(instance);
+    UNREFERENCED_PARAMETER(timer);
+
+    bp_apply_cached(bp, bp_unpark_in_ctx);
+}
+
+// Returns TRUE if delivery of this hit is suppressed.
+static BOOL debounce_hit(PHWBP bp, PCONTEXT ctx)
+{
+    PHWBP_DEBOUNCE debounce = &bp->debounce;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    if (ctx->Rip == debounce->lastIp && now.QuadPart - debounce->lastHit < debounce->ticks)
+    {
+        InterlockedIncrement64(&debounce->suppressed);
+        return TRUE;
+    }
+
+    debounce->lastIp = ctx->Rip;
+    debounce->lastHit = now.QuadPart;
+
+    if (debounce->park && debounce->timer)
+    {
+        lock_threads();
+        bp_park_in_ctx(bp, ctx);
+        shadow_store(bp->threadId, ctx);
+        unlock_threads();
+
+        InterlockedIncrement64(&debounce->parks);
+
+        // relative due time in 100ns units
+        ULARGE_INTEGER due;
+        due.QuadPart = (ULONGLONG)(-(LONGLONG)debounce->milliseconds * 10000);
+        FILETIME ft = {due.LowPart, due.HighPart};
+        SetThreadpoolTimer(debounce->timer, &ft, 0, 0);
+    }
+
+    return FALSE;
+}
+
+// Runs the breakpoints hit in ctx, the caller has announced the frame in t->depth.
+static LONG bp_dispatch(PHWBP_THREAD t, DWORD threadId, PCONTEXT ctx)
+{
+    dr6 _dr6;
+    dr7 _dr7;
+    _dr6.flags = ctx->Dr6;
+    _dr7.flags = ctx->Dr7;
+
+    // B0-B3 may be set for slots that are not enabled, only trust enabled ones.
+    // Snapshot the hits first, callbacks are free to rearrange the slots.
+    PHWBP hits[4] = {0};
+    BOOL handled = FALSE;
+
+    for (int8_t i = 0; i < 4; i++)
+    {
+        PHWBP bp = t->slots[i];
+
+        if (!(_dr6.breakpoint_condition & (1 << i)) || !(_dr7.flags & (1ull << (i * 2))))
+            continue;
+        if (!bp || (!bp->callback && !bp->counter && !bp->filter) || bp->index != i || bp->threadId != threadId)
+            continue;
+
+        hits[i] = bp;
+        handled = TRUE;
+    }
+
+    if (!handled)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    for (int8_t i = 0; i < 4; i++)
+    {
+        // an earlier callback may have destroyed it, possible only on this thread
+        if (!hits[i] || t->slots[i] != hits[i])
+            continue;
+
+        // execution breakpoints fault before the instruction, resume past them
+        if (hits[i]->read_write == INSTRUCTION_EXECUTION)
+            ctx->EFlags |= EFLAGS_RF;
+
+        if (hits[i]->filter && !bp_filter_run(hits[i]->filter, hits[i], ctx))
+            continue;
+
+        if (hits[i]->counter)
+            bp_counter_add(hits[i]->counter, 1);
+
+        if (hits[i]->debounce.ticks && debounce_hit(hits[i], ctx))
+            continue;
+
+        if (hits[i]->callback)
+            hits[i]->callback(hits[i], ctx, hits[i]->param);
+    }
+
+    ctx->Dr6 = 0;
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+static LONG CALLBACK bp_exception_handler(PEXCEPTION_POINTERS info)
+{
+    if (info->ExceptionRecord->ExceptionCode != EXCEPTION_SINGLE_STEP)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    PCONTEXT ctx = info->ContextRecord;
+    DWORD threadId = GetCurrentThreadId();
+    PHWBP_THREAD t = thread_lookup(threadId);
+
+    if (!t)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    // announce the frame before reading any slot, see bp_drain
+    if (!t->depth)
+        t->entered = t->version;
+    InterlockedIncrement(&t->depth);
+
+    LONG result = bp_dispatch(t, threadId, ctx);
+
+    InterlockedDecrement(&t->depth);
+
+    return result;
+}
+
+static BOOL install_handler(void)
+{
+    if (g_handler)
+        return TRUE;
+
+    PVOID handler = AddVectoredExceptionHandler(1, bp_exception_handler);
+    if (!handler)
+        return FALSE;
+
+    if (InterlockedCompareExchangePointer(&g_handler, handler, NULL) != NULL)
+        RemoveVectoredExceptionHandler(handler);
+
+    return TRUE;
+}
+
+BOOL bp_set_debounce(PHWBP bp, DWORD intervalMs, BOOL park)
+{
+    PHWBP_DEBOUNCE debounce = &bp->debounce;
+
+    if (debounce->timer)
+    {
+        SetThreadpoolTimer(debounce->timer, NULL, 0, 0);
+        WaitForThreadpoolTimerCallbacks(debounce->timer, TRUE);
+        CloseThreadpoolTimer(debounce->timer);
+        debounce->timer = NULL;
+    }
+
+    // a pending re-arm was just cancelled
+    if (debounce->parked)
+        bp_apply_cached(bp, bp_unpark_in_ctx);
+
+    debounce->ticks = 0;
+
+    if (!intervalMs)
+        return TRUE;
+
+    if (!install_handler())
+        return FALSE;
+
+    if (park)
+    {
+        debounce->timer = CreateThreadpoolTimer(debounce_timer, bp, NULL);
+        if (!debounce->timer)
+            return FALSE;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    debounce->park = park;
+    debounce->milliseconds = intervalMs;
+    debounce->lastIp = 0;
+    debounce->lastHit = 0;
+    debounce->ticks = frequency.QuadPart * intervalMs / 1000;
+
+    return TRUE;
+}
+
+BOOL bp_set_counter(PHWBP bp, PHWBP_COUNTER counter)
+{
+    if (counter && !install_handler())
+        return FALSE;
+
+    bp->counter = counter;
+
+    return TRUE;
+}
+
+BOOL bp_set_filter(PHWBP bp, PHWBP_FILTER filter)
+{
+    if (filter && !install_handler())
+        return FALSE;
+
+    bp->filter = filter;
+
+    return TRUE;
+}
+
+BOOL bp_set_callback(PHWBP bp, PHWBP_CALLBACK callback, LPVOID param)
+{
+    if (!install_handler())
+        return FALSE;
+
+    bp->param = param;
+    bp->callback = callback;
 
     return TRUE;
 }
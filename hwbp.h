@@ -2,6 +2,7 @@
 
 #include <Windows.h>
 #include "dr.h"
+#include "counter.h"
 
 typedef enum
 {
@@ -19,6 +20,68 @@ typedef enum
     FOUR_BYTE = 3
 } BP_LENGTH;
 
+// When a bp_enable_ex/bp_disable_ex change is guaranteed to be live on the target thread.
+//  BP_SYNC:  on return. The target is suspended and its context read back (which waits for
+//            the suspension to complete) before the debug registers are written, so the
+//            target executes no further instruction under the old state. For the calling
+//            thread the registers are reloaded on return from SetThreadContext. The HWBP
+//            fields are then published to all processors with FlushProcessWriteBuffers.
+//            Unless the target is dispatching a single-step exception: its registers are
+//            restored from the exception context when the handler continues, undoing the
+//            write. Arm from inside a callback with bp_enable_ctx/bp_disable_ctx instead.
+//  BP_ASYNC: the change is queued to the thread pool and the call returns immediately.
+//            It is live once bp_wait returns TRUE; until then hits may or may not occur.
+typedef enum
+{
+    BP_SYNC = 0,
+    BP_ASYNC = 1
+} BP_ARM_MODE;
+
+// Cost of arming per mode, in QueryPerformanceCounter ticks. callerTicks is the time
+// spent in bp_enable_ex/bp_disable_ex, completionTicks the time until the change was live.
+typedef struct _HWBP_ARM_STATS
+{
+    LONG64 count;
+    LONG64 callerTicks;
+    LONG64 completionTicks;
+} HWBP_ARM_STATS, *PHWBP_ARM_STATS;
+
+#define BP_WOW64_UNKNOWN 0xff
+
+// Register state of a thread in either layout. For a 32-bit (WOW64) thread ip/sp/fp are
+// Eip/Esp/Ebp and its arguments are on the stack from sp + 4.
+typedef struct _HWBP_REGS
+{
+    BOOL wow64;
+    DWORD64 ip;
+    DWORD64 sp;
+    DWORD64 fp;
+    DWORD64 flags;
+    DWORD64 dr6;
+    DWORD64 gpr[6]; // (R|E)ax, cx, dx, bx, si, di
+} HWBP_REGS, *PHWBP_REGS;
+
+// Delivery suppression for breakpoints in tight loops, see bp_set_debounce.
+typedef struct _HWBP_DEBOUNCE
+{
+    LONG64 ticks; // interval in QueryPerformanceCounter ticks, 0 when off
+    BOOL park;
+    DWORD milliseconds;
+    DWORD64 lastIp;
+    LONG64 lastHit;
+    volatile LONG64 suppressed; // hits counted but not delivered
+    volatile LONG64 parks;      // times the slot was parked, hits while parked are not seen
+    volatile LONG parked;
+    PTP_TIMER timer;
+} HWBP_DEBOUNCE, *PHWBP_DEBOUNCE;
+
+struct _HWBP;
+struct _HWBP_FILTER;
+
+// Called from the vectored exception handler on the thread that hit the breakpoint.
+// ctx is the faulting context; changes to it (including debug registers) take effect on return.
+typedef void (*PHWBP_CALLBACK)(struct _HWBP *bp, PCONTEXT ctx, LPVOID param);
+
 typedef struct _HWBP
 {
     LPVOID target;
@@ -27,13 +90,107 @@ typedef struct _HWBP
     BP_LENGTH length;
     int8_t index;
     uint8_t enabled;
+    uint8_t prepared; // slot held with the enable bit clear, see bp_prepare
+    uint8_t wow64;    // thread of a 32-bit process, BP_WOW64_UNKNOWN until first applied
+    HANDLE hThread;   // kept open while prepared
+    PHWBP_CALLBACK callback;
+    LPVOID param;
+    PHWBP_COUNTER counter; // optional, may be shared by the breakpoints of several threads
+    struct _HWBP_FILTER *filter; // optional, see filter.h
+    HWBP_DEBOUNCE debounce;
+    volatile LONG pending; // queued BP_ASYNC operation, 0 if none
+    volatile LONG result;  // outcome of the last BP_ASYNC operation
+    LARGE_INTEGER submitted;
+    LONG64 retired; // slot table version when bp last left its slot, see bp_drain
 } HWBP, *PHWBP;
 
 EXTERN_C_START
 
 PHWBP bp_create(LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LENGTH length);
+void bp_init(PHWBP bp, LPVOID lpTarget, DWORD threadId, BP_READ_WRITE read_write, BP_LENGTH length);
 BOOL bp_enable(PHWBP bp);
 BOOL bp_disable(PHWBP bp);
 void bp_destroy(PHWBP bp);
 
+// The exception handler reads a breakpoint without a lock. bp_destroy frees it only after
+// waiting for the handler frames that were running on its thread when it left its slot,
+// and bp_drain does the same wait for the owner of a bp_init breakpoint before its memory
+// is reused. A callback may destroy breakpoints of its own thread. One of another thread
+// would wait for that thread's handler, which may be waiting for this one: disable it
+// from the callback and destroy it later, outside any callback.
+void bp_drain(PHWBP bp);
+
+// bp_enable/bp_disable are BP_SYNC. Only one BP_ASYNC operation may be queued per
+// breakpoint at a time, a second one fails with ERROR_BUSY until bp_wait.
+BOOL bp_enable_ex(PHWBP bp, BP_ARM_MODE mode);
+BOOL bp_disable_ex(PHWBP bp, BP_ARM_MODE mode);
+BOOL bp_wait(PHWBP bp, DWORD dwMilliseconds);
+void bp_arm_stats(BP_ARM_MODE mode, PHWBP_ARM_STATS stats);
+
+// Enables/disables several breakpoints, possibly on several threads, as one unit: every
+// thread involved is suspended, written once with all of its members applied and only
+// then resumed, so no thread runs with part of the batch applied. All or nothing.
+BOOL bp_enable_batch(PHWBP *bps, DWORD count);
+BOOL bp_disable_batch(PHWBP *bps, DWORD count);
+
+// Claims a slot and writes the address, type and length with the enable bit clear.
+// Until bp_unprepare, bp_enable/bp_disable only flip that bit with one SetThreadContext
+// from a cached image of the thread's debug registers, no suspend or GetThreadContext.
+BOOL bp_prepare(PHWBP bp);
+BOOL bp_unprepare(PHWBP bp);
+
+// Moves an enabled or prepared breakpoint to a new address in the slot it already has,
+// rewriting only DRn and its LEN bits (one SetThreadContext when the cache is current).
+// On a breakpoint without a slot it only updates target and length.
+BOOL bp_retarget(PHWBP bp, LPVOID newTarget, BP_LENGTH newLength);
+
+// Reads a thread's registers, from its WOW64 context if it belongs to a 32-bit process.
+// Meant for a thread stopped at a debug event, a running thread gives a torn snapshot.
+BOOL bp_thread_regs(DWORD threadId, PHWBP_REGS regs);
+
+// For threads this copy does not manage, such as a debuggee's. bp_encode_slot writes bp
+// into slot idx of ctx, enabled, in the library's DR7 layout without claiming the slot
+// (set bp->wow64 first, an i386 thread cannot take every breakpoint); bp_clear_slot
+// empties slot idx. bp_get_debug_regs/bp_set_debug_regs move only Dr0-Dr3/Dr6/Dr7 in
+// and out of ctx, through the WOW64 context for a thread of a 32-bit process.
+BOOL bp_encode_slot(PHWBP bp, int8_t idx, PCONTEXT ctx);
+void bp_clear_slot(int8_t idx, PCONTEXT ctx);
+BOOL bp_get_debug_regs(HANDLE hThread, BOOL wow64, PCONTEXT ctx);
+BOOL bp_set_debug_regs(HANDLE hThread, BOOL wow64, PCONTEXT ctx);
+
+// Verifies a thread's live debug registers against this copy's bookkeeping: every slot
+// it tracks holds the breakpoint's address, type and length, is enabled unless dormant,
+// and is owned by this copy in the arbiter. FALSE with ERROR_INVALID_DATA on a mismatch.
+// Meant for stress tests of concurrent arm/disarm churn.
+BOOL bp_check_thread(DWORD threadId);
+
+// Ids of the threads of this process at the time of the call, to be freed with free().
+DWORD *bp_list_threads(DWORD *count);
+
+// TRUE once the thread has exited (or its id cannot be opened any more). Tells a failed
+// arm on a thread that left after a bp_list_threads snapshot from a real failure.
+BOOL bp_thread_exited(DWORD threadId);
+
+// Routes hits of bp to callback instead of leaving EXCEPTION_SINGLE_STEP to the caller's own handler.
+BOOL bp_set_callback(PHWBP bp, PHWBP_CALLBACK callback, LPVOID param);
+
+// Counts hits of bp into counter (NULL to stop). A breakpoint with a counter and no
+// callback is handled by the library: counted and resumed, nothing is delivered.
+BOOL bp_set_counter(PHWBP bp, PHWBP_COUNTER counter);
+
+// Runs filter on every hit of bp before the counter and callback (NULL to stop). A hit
+// the filter drops is resumed without being delivered. May be shared by several breakpoints.
+BOOL bp_set_filter(PHWBP bp, struct _HWBP_FILTER *filter);
+
+// After a hit has been delivered, further hits from the same IP within intervalMs are
+// only counted: the callback is skipped and debounce.suppressed incremented, so counter
+// totals stay exact. With park the slot is also disabled for the interval and re-armed
+// by a thread pool timer, which removes the trap cost but leaves those hits unseen
+// (debounce.parks records how often that happened). intervalMs 0 turns debouncing off.
+BOOL bp_set_debounce(PHWBP bp, DWORD intervalMs, BOOL park);
+
+// Arm/disarm bp in a context of its own (current) thread, e.g. the ctx passed to a callback.
+BOOL bp_enable_ctx(PHWBP bp, PCONTEXT ctx);
+BOOL bp_disable_ctx(PHWBP bp, PCONTEXT ctx);
+
 EXTERN_C_END
@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <immintrin.h>
+#include "match.h"
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+// Only the vector compare is built for AVX2, it runs after the runtime check.
+#if defined(__GNUC__)
+#define MATCH_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define MATCH_AVX2_TARGET
+#endif
+
+#define MATCH_PAGE_SHIFT 12
+#define MATCH_MEGABYTE_SHIFT 20
+
+static DWORD match_hash(DWORD64 key, DWORD64 multiplier)
+{
+    return (DWORD)((key * multiplier) >> (64 - 16));
+}
+
+static void bloom_set(DWORD64 *bloom, DWORD64 key)
+{
+    DWORD a = match_hash(key, 0x9e3779b97f4a7c15ull), b = match_hash(key, 0xc2b2ae3d27d4eb4full);
+
+    bloom[a / 64] |= 1ull << (a % 64);
+    bloom[b / 64] |= 1ull << (b % 64);
+}
+
+static BOOL bloom_test(const DWORD64 *bloom, DWORD64 key)
+{
+    DWORD a = match_hash(key, 0x9e3779b97f4a7c15ull), b = match_hash(key, 0xc2b2ae3d27d4eb4full);
+
+    return (bloom[a / 64] >> (a % 64)) & (bloom[b / 64] >> (b % 64)) & 1;
+}
+
+static const BYTE g_bits[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+// Number of keys not above address among the first n, whole blocks of four only.
+MATCH_AVX2_TARGET static SIZE_T match_count_below_avx2(const DWORD64 *keys, SIZE_T n, DWORD64 address)
+{
+    __m256i key = _mm256_set1_epi64x((LONG64)address);
+    SIZE_T below = 0;
+
+    for (SIZE_T i = 0; i + 4 <= n; i += 4)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+        int above = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block, key)));
+        below += 4 - g_bits[above];
+    }
+
+    return below;
+}
+
+// Number of keys not above address.
+static SIZE_T match_upper_bound(const DWORD64 *keys, SIZE_T count, BOOL avx2, DWORD64 address)
+{
+    SIZE_T base = 0, n = count;
+
+    // everything before base is known to be <= address, everything from base + n on above it
+    while (n > 16)
+    {
+        SIZE_T half = n / 2;
+        base = keys[base + half] <= address ? base + half : base;
+        n -= half;
+    }
+
+    SIZE_T i = 0, below = 0;
+
+    if (avx2)
+    {
+        below = match_count_below_avx2(keys + base, n, address);
+        i = n & ~(SIZE_T)3;
+    }
+
+    for (; i < n; i++)
+        below += keys[base + i] <= address;
+
+    return base + below;
+}
+
+static int compare_bounds(const void *a, const void *b)
+{
+    DWORD64 x = *(const DWORD64 *)a, y = *(const DWORD64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Max-heap of range indices, the range starting last on top.
+static void heap_push(SIZE_T *heap, SIZE_T *size, SIZE_T value)
+{
+    SIZE_T i = (*size)++;
+
+    for (; i > 0 && heap[(i - 1) / 2] < value; i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+
+    heap[i] = value;
+}
+
+static void heap_pop(SIZE_T *heap, SIZE_T *size)
+{
+    SIZE_T value = heap[--(*size)], i = 0;
+
+    for (;;)
+    {
+        SIZE_T child = i * 2 + 1;
+        if (child >= *size)
+            break;
+        if (child + 1 < *size && heap[child + 1] > heap[child])
+            child++;
+        if (heap[child] <= value)
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = value;
+}
+
+static void index_free(PHWBP_MATCH_INDEX index)
+{
+    if (!index)
+        return;
+
+    free(index->ranges);
+    free(index->bounds);
+    free(index->owner);
+    free(index);
+}
+
+// caller holds lock
+static PHWBP_MATCH_INDEX index_build(PHWBP_MATCH match)
+{
+    SIZE_T n = match->count;
+    PHWBP_MATCH_INDEX index = (PHWBP_MATCH_INDEX)calloc(1, sizeof(HWBP_MATCH_INDEX));
+    SIZE_T *heap = (SIZE_T *)malloc(max(n, 1) * sizeof(SIZE_T));
+
+    if (index)
+    {
+        index->ranges = (HWBP_MATCH_RANGE *)malloc(max(n, 1) * sizeof(HWBP_MATCH_RANGE));
+        index->bounds = (DWORD64 *)malloc(max(n * 2, 1) * sizeof(DWORD64));
+        index->owner = (SIZE_T *)malloc(max(n * 2, 1) * sizeof(SIZE_T));
+    }
+
+    if (!index || !heap || !index->ranges || !index->bounds || !index->owner)
+    {
+        index_free(index);
+        free(heap);
+        return NULL;
+    }
+
+    index->count = n;
+    memcpy(index->ranges, match->ranges, n * sizeof(HWBP_MATCH_RANGE));
+
+    for (SIZE_T i = 0; i < n; i++)
+    {
+        index->bounds[i * 2] = index->ranges[i].start;
+        index->bounds[i * 2 + 1] = index->ranges[i].end;
+    }
+
+    qsort(index->bounds, n * 2, sizeof(DWORD64), compare_bounds);
+
+    for (SIZE_T i = 0; i < n * 2; i++)
+    {
+        if (!index->nbounds || index->bounds[index->nbounds - 1] != index->bounds[i])
+            index->bounds[index->nbounds++] = index->bounds[i];
+    }
+
+    // Sweep the boundaries with every range started so far on the heap. A range that has
+    // ended is only dropped once it surfaces, the one on top then holds the stretch.
+    SIZE_T next = 0, size = 0;
+
+    for (SIZE_T k = 0; k < index->nbounds; k++)
+    {
+        while (next < n && index->ranges[next].start <= index->bounds[k])
+            heap_push(heap, &size, next++);
+        while (size && index->ranges[heap[0]].end <= index->bounds[k])
+            heap_pop(heap, &size);
+
+        index->owner[k] = size ? heap[0] : n;
+    }
+
+    free(heap);
+
+    for (SIZE_T i = 0; i < n; i++)
+    {
+        PHWBP_MATCH_RANGE range = &index->ranges[i];
+        DWORD64 first = range->start >> MATCH_PAGE_SHIFT, last = (range->end - 1) >> MATCH_PAGE_SHIFT;
+
+        if (last - first < HWBP_MATCH_WIDE_PAGES)
+        {
+            for (DWORD64 page = first; page <= last; page++)
+                bloom_set(index->pages, page);
+            continue;
+        }
+
+        first = range->start >> MATCH_MEGABYTE_SHIFT;
+        last = (range->end - 1) >> MATCH_MEGABYTE_SHIFT;
+
+        if (last - first < HWBP_MATCH_WIDE_PAGES)
+        {
+            for (DWORD64 megabyte = first; megabyte <= last; megabyte++)
+                bloom_set(index->megabytes, megabyte);
+        }
+        else
+        {
+            index->everything = TRUE;
+        }
+    }
+
+    return index;
+}
+
+// caller holds lock
+static void index_publish(PHWBP_MATCH match, PHWBP_MATCH_INDEX index)
+{
+    PHWBP_MATCH_INDEX old = (PHWBP_MATCH_INDEX)InterlockedExchangePointer((PVOID volatile *)&match->index, index);
+
+    // readers that may still hold old registered under the epoch before this one
+    LONG epoch = InterlockedIncrement(&match->epoch) - 1;
+
+    for (DWORD stripe = 0; stripe < HWBP_MATCH_STRIPES; stripe++)
+    {
+        for (DWORD spins = 0; match->readers[epoch & 1][stripe].count; spins++)
+        {
+            if (spins < 64)
+                YieldProcessor();
+            else
+                SwitchToThread();
+        }
+    }
+
+    index_free(old);
+}
+
+static PHWBP_MATCH_INDEX reader_enter(PHWBP_MATCH match, volatile LONG **counter)
+{
+    DWORD stripe = GetCurrentProcessorNumber() % HWBP_MATCH_STRIPES;
+
+    for (;;)
+    {
+        LONG epoch = match->epoch;
+        volatile LONG *count = &match->readers[epoch & 1][stripe].count;
+
+        InterlockedIncrement(count);
+
+        // a writer that flipped the epoch in between would not wait for this counter
+        if (match->epoch == epoch)
+        {
+            *counter = count;
+            return match->index;
+        }
+
+        InterlockedDecrement(count);
+    }
+}
+
+PHWBP_MATCH bp_match_create(void)
+{
+    PHWBP_MATCH match = (PHWBP_MATCH)_aligned_malloc(sizeof(HWBP_MATCH), 64);
+    if (!match)
+        return NULL;
+
+    memset(match, 0, sizeof(HWBP_MATCH));
+    InitializeSRWLock(&match->lock);
+    match->avx2 = IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE);
+    match->index = index_build(match);
+
+    if (!match->index)
+    {
+        _aligned_free(match);
+        return NULL;
+    }
+
+    return match;
+}
+
+void bp_match_destroy(PHWBP_MATCH match)
+{
+    index_free(match->index);
+    free(match->ranges);
+    _aligned_free(match);
+}
+
+static BOOL match_grow(PHWBP_MATCH match)
+{
+    SIZE_T capacity = match->capacity ? match->capacity * 2 : 64;
+
+    HWBP_MATCH_RANGE *ranges = (HWBP_MATCH_RANGE *)realloc(match->ranges, capacity * sizeof(HWBP_MATCH_RANGE));
+    if (!ranges)
+        return FALSE;
+
+    match->ranges = ranges;
+    match->capacity = capacity;
+    return TRUE;
+}
+
+BOOL bp_match_add(PHWBP_MATCH match, LPVOID start, SIZE_T size, LPVOID param)
+{
+    DWORD64 address = (DWORD64)start;
+
+    if (!size || address + size < address)
+        return FALSE;
+
+    AcquireSRWLockExclusive(&match->lock);
+
+    BOOL ok = match->count < match->capacity || match_grow(match);
+
+    if (ok)
+    {
+        // after every range starting at or below address
+        SIZE_T i = 0;
+        while (i < match->count && match->ranges[i].start <= address)
+            i++;
+
+        memmove(&match->ranges[i + 1], &match->ranges[i], (match->count - i) * sizeof(HWBP_MATCH_RANGE));
+        match->ranges[i].start = address;
+        match->ranges[i].end = address + size;
+        match->ranges[i].param = param;
+        match->count++;
+
+        PHWBP_MATCH_INDEX index = index_build(match);
+        ok = index != NULL;
+
+        if (ok)
+        {
+            index_publish(match, index);
+        }
+        else
+        {
+            match->count--;
+            memmove(&match->ranges[i], &match->ranges[i + 1], (match->count - i) * sizeof(HWBP_MATCH_RANGE));
+        }
+    }
+
+    ReleaseSRWLockExclusive(&match->lock);
+
+    return ok;
+}
+
+BOOL bp_match_remove(PHWBP_MATCH match, LPVOID start)
+{
+    BOOL found = FALSE;
+
+    AcquireSRWLockExclusive(&match->lock);
+
+    for (SIZE_T i = 0; i < match->count; i++)
+    {
+        if (match->ranges[i].start != (DWORD64)start)
+            continue;
+
+        HWBP_MATCH_RANGE removed = match->ranges[i];
+
+        match->count--;
+        memmove(&match->ranges[i], &match->ranges[i + 1], (match->count - i) * sizeof(HWBP_MATCH_RANGE));
+
+        PHWBP_MATCH_INDEX index = index_build(match);
+        found = index != NULL;
+
+        if (found)
+        {
+            index_publish(match, index);
+        }
+        else
+        {
+            memmove(&match->ranges[i + 1], &match->ranges[i], (match->count - i) * sizeof(HWBP_MATCH_RANGE));
+            match->ranges[i] = removed;
+            match->count++;
+        }
+        break;
+    }
+
+    ReleaseSRWLockExclusive(&match->lock);
+
+    return found;
+}
+
+BOOL bp_match_find(PHWBP_MATCH match, LPVOID address, PHWBP_MATCH_RANGE range)
+{
+    DWORD64 key = (DWORD64)address;
+    BOOL found = FALSE;
+    volatile LONG *counter;
+
+    PHWBP_MATCH_INDEX index = reader_enter(match, &counter);
+
+    if (index->everything || bloom_test(index->pages, key >> MATCH_PAGE_SHIFT) ||
+        bloom_test(index->megabytes, key >> MATCH_MEGABYTE_SHIFT))
+    {
+        SIZE_T k = match_upper_bound(index->bounds, index->nbounds, match->avx2, key);
+
+        if (k && index->owner[k - 1] != index->count)
+        {
+            *range = index->ranges[index->owner[k - 1]];
+            found = TRUE;
+        }
+    }
+
+    InterlockedDecrement(counter);
+
+    return found;
+}
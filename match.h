@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Windows.h>
+
+// Address to watched range lookup for software watches, where every fault or dirty
+// page has to be matched against possibly thousands of ranges. Two bloom filters, by
+// 4K page and by megabyte for large ranges, turn away unrelated addresses before the
+// search. The search is a branchless binary search over the sorted boundaries of the
+// ranges that finishes with a vector compare over the last few; the answer for every
+// stretch between two boundaries is precomputed, so overlapping ranges cost nothing
+// at lookup time however many there are.
+//
+// Lookups take no lock. Adding and removing build a new immutable index and publish it
+// with one pointer swap; the old one is freed once no lookup can still be reading it.
+// Readers announce themselves in per-processor counters split by epoch, the writer
+// flips the epoch after the swap and waits for the old epoch's counters to drain.
+//
+// Addresses are user-mode addresses (below 2^63), the vector compare is signed.
+
+#define HWBP_MATCH_BLOOM_BITS 65536
+#define HWBP_MATCH_WIDE_PAGES 1024 // ranges larger than this go in the megabyte filter
+#define HWBP_MATCH_STRIPES 16
+
+typedef struct _HWBP_MATCH_RANGE
+{
+    DWORD64 start;
+    DWORD64 end; // exclusive
+    LPVOID param;
+} HWBP_MATCH_RANGE, *PHWBP_MATCH_RANGE;
+
+// Never modified once published.
+typedef struct _HWBP_MATCH_INDEX
+{
+    HWBP_MATCH_RANGE *ranges; // sorted by start
+    SIZE_T count;
+    DWORD64 *bounds; // every distinct start and end, sorted
+    SIZE_T *owner;   // range holding [bounds[i], bounds[i + 1]), count if none
+    SIZE_T nbounds;
+    BOOL everything; // a range too large even for the megabyte filter
+    DWORD64 pages[HWBP_MATCH_BLOOM_BITS / 64];
+    DWORD64 megabytes[HWBP_MATCH_BLOOM_BITS / 64];
+} HWBP_MATCH_INDEX, *PHWBP_MATCH_INDEX;
+
+typedef struct _HWBP_MATCH_READERS
+{
+    DECLSPEC_ALIGN(64) volatile LONG count;
+} HWBP_MATCH_READERS;
+
+typedef struct _HWBP_MATCH
+{
+    HWBP_MATCH_READERS readers[2][HWBP_MATCH_STRIPES]; // by epoch parity and processor
+    volatile LONG epoch;
+    PHWBP_MATCH_INDEX volatile index;
+    BOOL avx2;
+
+    // writers only
+    SRWLOCK lock;
+    HWBP_MATCH_RANGE *ranges; // sorted by start
+    SIZE_T count;
+    SIZE_T capacity;
+} HWBP_MATCH, *PHWBP_MATCH;
+
+EXTERN_C_START
+
+PHWBP_MATCH bp_match_create(void);
+void bp_match_destroy(PHWBP_MATCH match);
+
+// Adding and removing rebuild the index, lookups are what is meant to be fast.
+BOOL bp_match_add(PHWBP_MATCH match, LPVOID start, SIZE_T size, LPVOID param);
+BOOL bp_match_remove(PHWBP_MATCH match, LPVOID start);
+
+// Finds the range holding address, among overlapping ones the one starting last.
+// Lock-free, may run concurrently with adding and removing.
+BOOL bp_match_find(PHWBP_MATCH match, LPVOID address, PHWBP_MATCH_RANGE range);
+
+EXTERN_C_END
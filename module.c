@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+#include "module.h"
+#include <winternl.h>
+
+#define LDR_DLL_NOTIFICATION_REASON_LOADED 1
+#define LDR_DLL_NOTIFICATION_REASON_UNLOADED 2
+
+// ntdll's notification data, the same layout for both reasons
+typedef struct _LDR_DLL_NOTIFICATION_DATA
+{
+    ULONG Flags;
+    const UNICODE_STRING *FullDllName;
+    const UNICODE_STRING *BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+} LDR_DLL_NOTIFICATION_DATA;
+
+typedef VOID(CALLBACK *PLDR_DLL_NOTIFICATION_FUNCTION)(ULONG reason, const LDR_DLL_NOTIFICATION_DATA *data, PVOID context);
+typedef NTSTATUS(NTAPI *PLDR_REGISTER_DLL_NOTIFICATION)(ULONG flags, PLDR_DLL_NOTIFICATION_FUNCTION callback, PVOID context, PVOID *cookie);
+typedef NTSTATUS(NTAPI *PLDR_UNREGISTER_DLL_NOTIFICATION)(PVOID cookie);
+
+static PHWBP_MODULE_WATCH g_module_watches = NULL;
+static SRWLOCK g_module_lock = SRWLOCK_INIT;
+static PVOID g_module_cookie = NULL;
+
+static void module_release(PHWBP_MODULE_WATCH watch)
+{
+    for (DWORD i = 0; i < watch->count; i++)
+        bp_destroy(watch->bps[i]);
+
+    free(watch->bps);
+    watch->bps = NULL;
+    watch->count = 0;
+    watch->base = NULL;
+}
+
+static BOOL module_create(PHWBP_MODULE_WATCH watch, LPVOID base, const DWORD *threads, DWORD count)
+{
+    watch->bps = (PHWBP *)calloc(count, sizeof(PHWBP));
+    if (!watch->bps)
+        return FALSE;
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        PHWBP bp = bp_create((BYTE *)base + watch->offset, threads[i], watch->read_write, watch->length);
+        if (!bp)
+        {
+            module_release(watch);
+            return FALSE;
+        }
+
+        watch->bps[watch->count++] = bp;
+    }
+
+    watch->base = base;
+    return TRUE;
+}
+
+// The batch is all or nothing, one thread exiting since the snapshot fails it for all.
+// Enables the breakpoints one at a time instead, dropping those of exited threads; a
+// live thread that cannot take its breakpoint still fails the watch.
+static BOOL module_enable_each(PHWBP_MODULE_WATCH watch)
+{
+    DWORD kept = 0;
+
+    for (DWORD i = 0; i < watch->count; i++)
+    {
+        PHWBP bp = watch->bps[i];
+
+        if (bp_enable(bp))
+        {
+            watch->bps[kept++] = bp;
+            continue;
+        }
+
+        DWORD error = GetLastError();
+        if (!bp_thread_exited(bp->threadId))
+        {
+            // keep the rest for module_release, the dropped ones are already destroyed
+            for (DWORD j = i; j < watch->count; j++)
+                watch->bps[kept++] = watch->bps[j];
+
+            watch->count = kept;
+            SetLastError(error);
+            return FALSE;
+        }
+
+        bp_destroy(bp);
+    }
+
+    watch->count = kept;
+    return TRUE;
+}
+
+static void module_failed(PHWBP_MODULE_WATCH watch, DWORD error)
+{
+    watch->error = error;
+    InterlockedIncrement64(&watch->failures);
+}
+
+// caller holds g_module_lock
+static void module_loaded(LPCWSTR name, LPVOID base)
+{
+    DWORD count, watches = 0, fresh = 0, total = 0;
+    DWORD *threads = bp_list_threads(&count);
+
+    for (PHWBP_MODULE_WATCH watch = g_module_watches; watch; watch = watch->next)
+        watches++;
+
+    PHWBP_MODULE_WATCH *armed = threads ? (PHWBP_MODULE_WATCH *)malloc(watches * sizeof(PHWBP_MODULE_WATCH)) : NULL;
+
+    for (PHWBP_MODULE_WATCH watch = g_module_watches; watch; watch = watch->next)
+    {
+        if (watch->base || _wcsicmp(watch->module, name))
+            continue;
+
+        if (armed && module_create(watch, base, threads, count))
+        {
+            armed[fresh++] = watch;
+            total += watch->count;
+        }
+        else
+        {
+            module_failed(watch, GetLastError());
+        }
+    }
+
+    free(threads);
+
+    // every new watch on the module in one batch, a single suspend and write per thread
+    PHWBP *batch = total ? (PHWBP *)malloc(total * sizeof(PHWBP)) : NULL;
+
+    for (DWORD i = 0, n = 0; batch && i < fresh; n += armed[i++]->count)
+        memcpy(batch + n, armed[i]->bps, armed[i]->count * sizeof(PHWBP));
+
+    BOOL batched = batch && bp_enable_batch(batch, total);
+
+    for (DWORD i = 0; i < fresh; i++)
+    {
+        if (batched || module_enable_each(armed[i]))
+        {
+            InterlockedIncrement64(&armed[i]->loads);
+            continue;
+        }
+
+        module_failed(armed[i], GetLastError());
+        module_release(armed[i]);
+    }
+
+    free(batch);
+    free(armed);
+}
+
+// caller holds g_module_lock
+static void module_unloaded(LPVOID base)
+{
+    for (PHWBP_MODULE_WATCH watch = g_module_watches; watch; watch = watch->next)
+    {
+        if (watch->base != base)
+            continue;
+
+        bp_disable_batch(watch->bps, watch->count);
+        module_release(watch);
+    }
+}
+
+// Called with the loader lock held, before DllMain on a load and after it on an unload.
+static VOID CALLBACK module_notification(ULONG reason, const LDR_DLL_NOTIFICATION_DATA *data, PVOID context)
+{
+    WCHAR name[MAX_PATH];
+
+    UNREFERENCED_PARAMETER(context);
+
+    AcquireSRWLockExclusive(&g_module_lock);
+
+    if (reason == LDR_DLL_NOTIFICATION_REASON_LOADED)
+    {
+        USHORT length = min(data->BaseDllName->Length / sizeof(WCHAR), MAX_PATH - 1);
+        memcpy(name, data->BaseDllName->Buffer, length * sizeof(WCHAR));
+        name[length] = L'\0';
+
+        module_loaded(name, data->DllBase);
+    }
+    else if (reason == LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+    {
+        module_unloaded(data->DllBase);
+    }
+
+    ReleaseSRWLockExclusive(&g_module_lock);
+}
+
+// caller holds g_module_lock
+static BOOL module_register(void)
+{
+    if (g_module_cookie)
+        return TRUE;
+
+    PLDR_REGISTER_DLL_NOTIFICATION reg =
+        (PLDR_REGISTER_DLL_NOTIFICATION)GetProcAddress(GetModuleHandleA("ntdll.dll"), "LdrRegisterDllNotification");
+
+    return reg && NT_SUCCESS(reg(0, module_notification, NULL, &g_module_cookie));
+}
+
+// caller holds g_module_lock
+static void module_unregister(void)
+{
+    PLDR_UNREGISTER_DLL_NOTIFICATION unreg =
+        (PLDR_UNREGISTER_DLL_NOTIFICATION)GetProcAddress(GetModuleHandleA("ntdll.dll"), "LdrUnregisterDllNotification");
+
+    if (g_module_cookie && unreg)
+        unreg(g_module_cookie);
+
+    g_module_cookie = NULL;
+}
+
+PHWBP_MODULE_WATCH bp_module_watch(LPCWSTR module, DWORD offset, BP_READ_WRITE read_write, BP_LENGTH length)
+{
+    PHWBP_MODULE_WATCH watch = (PHWBP_MODULE_WATCH)calloc(1, sizeof(HWBP_MODULE_WATCH));
+    if (!watch)
+        return NULL;
+
+    wcsncpy_s(watch->module, MAX_PATH, module, _TRUNCATE);
+    watch->offset = offset;
+    watch->read_write = read_write;
+    watch->length = length;
+
+    AcquireSRWLockExclusive(&g_module_lock);
+
+    if (!module_register())
+    {
+        ReleaseSRWLockExclusive(&g_module_lock);
+        free(watch);
+        return NULL;
+    }
+
+    watch->next = g_module_watches;
+    g_module_watches = watch;
+
+    // registered first, so a load racing with this either is seen here or notified
+    HMODULE hModule = GetModuleHandleW(module);
+    if (hModule)
+        module_loaded(watch->module, hModule);
+
+    BOOL ok = !hModule || watch->base;
+
+    ReleaseSRWLockExclusive(&g_module_lock);
+
+    if (!ok)
+    {
+        DWORD error = watch->error;
+        bp_module_unwatch(watch);
+        SetLastError(error);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void bp_module_unwatch(PHWBP_MODULE_WATCH watch)
+{
+    AcquireSRWLockExclusive(&g_module_lock);
+
+    for (PHWBP_MODULE_WATCH *link = &g_module_watches; *link; link = &(*link)->next)
+    {
+        if (*link == watch)
+        {
+            *link = watch->next;
+            break;
+        }
+    }
+
+    if (watch->base)
+    {
+        bp_disable_batch(watch->bps, watch->count);
+        module_release(watch);
+    }
+
+    if (!g_module_watches)
+        module_unregister();
+
+    ReleaseSRWLockExclusive(&g_module_lock);
+
+    free(watch);
+}
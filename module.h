@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Breakpoints given as module + offset instead of an absolute address, so they survive
+// ASLR and DLLs being unloaded and loaded again. The loader's DLL notifications drive
+// them: when the module is loaded every watch on it is created on all threads and
+// enabled as one batch, when it is unloaded they are disabled before the image is
+// unmapped, so no slot is left pointing at memory that may be reused. A thread that
+// exits between the snapshot and the batch is dropped rather than failing the load.
+//
+// As with other whole-process watches, threads created after the module was loaded
+// are not covered.
+
+typedef struct _HWBP_MODULE_WATCH
+{
+    WCHAR module[MAX_PATH]; // base name, e.g. L"plugin.dll", case insensitive
+    DWORD offset;
+    BP_READ_WRITE read_write;
+    BP_LENGTH length;
+    LPVOID base; // NULL while not loaded or not armed
+    PHWBP *bps;
+    DWORD count;
+    volatile LONG64 loads; // times armed on a load
+    volatile LONG64 failures; // loads on which it could not be armed
+    DWORD error;              // GetLastError of the last of them
+    struct _HWBP_MODULE_WATCH *next;
+} HWBP_MODULE_WATCH, *PHWBP_MODULE_WATCH;
+
+EXTERN_C_START
+
+// Armed at once if the module is already loaded. A load on which the watch cannot be
+// armed leaves it disarmed until the next load and is counted in failures; the
+// immediate arm failing also fails this call.
+PHWBP_MODULE_WATCH bp_module_watch(LPCWSTR module, DWORD offset, BP_READ_WRITE read_write, BP_LENGTH length);
+void bp_module_unwatch(PHWBP_MODULE_WATCH watch);
+
+EXTERN_C_END
@@ -0,0 +1,590 @@
+#include <stdlib.h>
+#include <string.h>
+#include "narrow.h"
+
+typedef struct _NARROW_WORD
+{
+    DWORD64 address;
+    LONG64 changes;
+} NARROW_WORD;
+
+static PHWBP_NARROW g_narrows = NULL;
+static SRWLOCK g_narrows_lock = SRWLOCK_INIT; // the list, taken before any narrow->lock
+
+// Arms threads as they start and disarms them as they exit, as tls.c does for its watches.
+static void NTAPI narrow_thread_callback(PVOID module, DWORD reason, PVOID reserved);
+
+#ifdef _MSC_VER
+#pragma comment(linker, "/INCLUDE:_tls_used")
+#pragma comment(linker, "/INCLUDE:hwbp_narrow_tls_callback")
+#pragma section(".CRT$XLH", read)
+EXTERN_C __declspec(allocate(".CRT$XLH")) const PIMAGE_TLS_CALLBACK hwbp_narrow_tls_callback = narrow_thread_callback;
+#else
+__attribute__((section(".CRT$XLH"), used)) const PIMAGE_TLS_CALLBACK hwbp_narrow_tls_callback = narrow_thread_callback;
+#endif
+
+// Data breakpoints trap after the write, so ip is the instruction following the writer.
+static void narrow_hit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    HWBP_NARROW_SLOT *slot = (HWBP_NARROW_SLOT *)param;
+    LONG index = slot->candidate;
+
+    UNREFERENCED_PARAMETER(bp);
+
+    if (index < 0)
+        return;
+
+    PHWBP_NARROW_CANDIDATE candidate = &slot->narrow->candidates[index];
+
+    InterlockedIncrement64(&candidate->hits);
+    candidate->lastThread = GetCurrentThreadId();
+
+    for (DWORD i = 0; i < HWBP_NARROW_IPS; i++)
+    {
+        DWORD64 ip = candidate->ips[i].ip;
+
+        if (!ip && !InterlockedCompareExchange64((volatile LONG64 *)&candidate->ips[i].ip, (LONG64)ctx->Rip, 0))
+            ip = ctx->Rip;
+        else if (!ip)
+            ip = candidate->ips[i].ip;
+
+        if (ip == ctx->Rip)
+        {
+            InterlockedIncrement64(&candidate->ips[i].count);
+            break;
+        }
+    }
+}
+
+static LONG narrow_slotted(PHWBP_NARROW narrow, LONG index)
+{
+    for (LONG i = 0; i < HWBP_NARROW_SLOTS; i++)
+    {
+        if (narrow->slots[i].candidate == index)
+            return i;
+    }
+
+    return -1;
+}
+
+static LONG narrow_find(PHWBP_NARROW narrow, DWORD64 address)
+{
+    for (DWORD i = 0; i < narrow->candidateCount; i++)
+    {
+        if (narrow->candidates[i].address == address)
+            return (LONG)i;
+    }
+
+    return -1;
+}
+
+// Takes the entry of a new word, evicting the least interesting one not under a slot.
+static LONG narrow_insert(PHWBP_NARROW narrow, NARROW_WORD word)
+{
+    LONG index = narrow_find(narrow, word.address);
+    if (index != -1)
+        return index;
+
+    if (narrow->candidateCount < HWBP_NARROW_CANDIDATES)
+    {
+        index = (LONG)narrow->candidateCount++;
+    }
+    else
+    {
+        for (LONG i = 0; i < HWBP_NARROW_CANDIDATES; i++)
+        {
+            PHWBP_NARROW_CANDIDATE c = &narrow->candidates[i];
+
+            if (narrow_slotted(narrow, i) != -1)
+                continue;
+
+            if (index == -1 || c->hits < narrow->candidates[index].hits ||
+                (c->hits == narrow->candidates[index].hits && c->changes < narrow->candidates[index].changes))
+                index = i;
+        }
+
+        if (index == -1)
+            return -1;
+    }
+
+    PHWBP_NARROW_CANDIDATE candidate = &narrow->candidates[index];
+    memset(candidate, 0, sizeof(*candidate));
+    candidate->address = word.address;
+    candidate->changes = word.changes;
+
+    return index;
+}
+
+static HWBP_NARROW_PAGE *narrow_page(PHWBP_NARROW narrow, DWORD64 address, BOOL *fresh)
+{
+    HWBP_NARROW_PAGE *victim = NULL;
+
+    *fresh = FALSE;
+
+    for (DWORD i = 0; i < HWBP_NARROW_PAGES; i++)
+    {
+        HWBP_NARROW_PAGE *page = &narrow->pages[i];
+
+        if (page->address == address)
+            return page;
+
+        if (!victim || !page->address ||
+            (victim->address && (page->dirty < victim->dirty ||
+                                 (page->dirty == victim->dirty && page->lastScan < victim->lastScan))))
+            victim = page;
+    }
+
+    victim->address = address;
+    victim->dirty = 0;
+    memset(victim->changes, 0, narrow->region->pageSize / sizeof(DWORD64) * sizeof(DWORD));
+    memcpy(victim->snapshot, (const void *)address, narrow->region->pageSize);
+
+    *fresh = TRUE;
+    return victim;
+}
+
+static void narrow_diff(PHWBP_NARROW narrow, HWBP_NARROW_PAGE *page)
+{
+    const volatile DWORD64 *now = (const volatile DWORD64 *)page->address;
+    DWORD64 *then = (DWORD64 *)page->snapshot;
+    DWORD words = narrow->region->pageSize / sizeof(DWORD64);
+
+    for (DWORD w = 0; w < words; w++)
+    {
+        DWORD64 value = now[w];
+        if (value == then[w])
+            continue;
+
+        then[w] = value;
+        page->changes[w]++;
+
+        LONG index = narrow_find(narrow, page->address + w * sizeof(DWORD64));
+        if (index != -1)
+            narrow->candidates[index].changes++;
+    }
+}
+
+static void narrow_top(PHWBP_NARROW narrow, NARROW_WORD *top)
+{
+    DWORD words = narrow->region->pageSize / sizeof(DWORD64);
+
+    memset(top, 0, HWBP_NARROW_SLOTS * sizeof(NARROW_WORD));
+
+    for (DWORD i = 0; i < HWBP_NARROW_PAGES; i++)
+    {
+        HWBP_NARROW_PAGE *page = &narrow->pages[i];
+        if (!page->address)
+            continue;
+
+        for (DWORD w = 0; w < words; w++)
+        {
+            LONG64 changes = page->changes[w];
+            if (changes <= top[HWBP_NARROW_SLOTS - 1].changes)
+                continue;
+
+            DWORD j = HWBP_NARROW_SLOTS - 1;
+            for (; j > 0 && top[j - 1].changes < changes; j--)
+                top[j] = top[j - 1];
+
+            top[j].address = page->address + w * sizeof(DWORD64);
+            top[j].changes = changes;
+        }
+    }
+}
+
+static BOOL narrow_covers(HWBP_NARROW_SLOT *slot, DWORD threadId)
+{
+    for (DWORD i = 0; i < slot->count; i++)
+    {
+        if (slot->bps[i]->threadId == threadId)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+// A breakpoint for threadId at the slot's target, not enabled.
+// caller holds narrow->lock
+static PHWBP narrow_add(HWBP_NARROW_SLOT *slot, DWORD threadId)
+{
+    if (slot->count == slot->capacity)
+    {
+        DWORD capacity = slot->capacity ? slot->capacity * 2 : 64;
+        PHWBP *bps = (PHWBP *)realloc(slot->bps, capacity * sizeof(PHWBP));
+        if (!bps)
+            return NULL;
+
+        slot->bps = bps;
+        slot->capacity = capacity;
+    }
+
+    PHWBP bp = bp_create(slot->target, threadId, DATA_WRITEONLY, EIGHT_BYTE);
+
+    if (bp && !bp_set_callback(bp, narrow_hit, slot))
+    {
+        bp_destroy(bp);
+        bp = NULL;
+    }
+
+    if (bp)
+        slot->bps[slot->count++] = bp;
+
+    return bp;
+}
+
+// caller holds narrow->lock
+static void narrow_drop(HWBP_NARROW_SLOT *slot, DWORD i)
+{
+    bp_destroy(slot->bps[i]);
+    slot->bps[i] = slot->bps[--slot->count];
+}
+
+// Rebuilds the slot's breakpoints from the threads that exist now: those of exited
+// threads are destroyed, threads without one get one.
+// caller holds narrow->lock
+static BOOL narrow_sync(HWBP_NARROW_SLOT *slot)
+{
+    DWORD count;
+    DWORD *threads = bp_list_threads(&count);
+    BOOL ok = threads != NULL;
+
+    for (DWORD i = 0; ok && i < slot->count;)
+    {
+        BOOL alive = FALSE;
+        for (DWORD t = 0; t < count && !alive; t++)
+            alive = threads[t] == slot->bps[i]->threadId;
+
+        if (alive)
+            i++;
+        else
+            narrow_drop(slot, i);
+    }
+
+    for (DWORD t = 0; ok && t < count; t++)
+    {
+        if (!narrow_covers(slot, threads[t]))
+            ok = narrow_add(slot, threads[t]) != NULL;
+    }
+
+    free(threads);
+    return ok;
+}
+
+// Points every breakpoint of the slot at target and enables it, in one batch when it
+// can. A thread that has exited fails the batch for all, so the breakpoints are then
+// taken one at a time and an exited thread only loses its own. FALSE if a live thread
+// could not be armed; the others still are.
+// caller holds narrow->lock
+static BOOL narrow_arm(HWBP_NARROW_SLOT *slot, LPVOID target)
+{
+    BOOL ok = TRUE;
+
+    slot->target = target;
+
+    if (!slot->enabled)
+    {
+        for (DWORD i = 0; i < slot->count; i++)
+            bp_retarget(slot->bps[i], target, EIGHT_BYTE);
+
+        if (bp_enable_batch(slot->bps, slot->count))
+        {
+            slot->enabled = TRUE;
+            return TRUE;
+        }
+    }
+
+    for (DWORD i = 0; i < slot->count;)
+    {
+        PHWBP bp = slot->bps[i];
+
+        if (bp_retarget(bp, target, EIGHT_BYTE) && (bp->enabled || bp_enable(bp)))
+        {
+            i++;
+        }
+        else if (bp_thread_exited(bp->threadId))
+        {
+            narrow_drop(slot, i);
+        }
+        else
+        {
+            ok = FALSE;
+            i++;
+        }
+    }
+
+    slot->enabled = ok;
+    return ok;
+}
+
+// caller holds narrow->lock
+static void narrow_move(PHWBP_NARROW narrow, HWBP_NARROW_SLOT *slot, LONG index)
+{
+    LPVOID target = (LPVOID)narrow->candidates[index].address;
+
+    // hits racing with the move are dropped rather than credited to the wrong word
+    slot->candidate = -1;
+
+    // rebuilt once from the threads that exist now, the slot watches whatever it got
+    if (!narrow_arm(slot, target) && narrow_sync(slot))
+        narrow_arm(slot, target);
+
+    if (slot->count)
+        slot->candidate = index;
+}
+
+static void narrow_place(PHWBP_NARROW narrow, const NARROW_WORD *top)
+{
+    LONG wanted[HWBP_NARROW_SLOTS];
+
+    for (DWORD i = 0; i < HWBP_NARROW_SLOTS; i++)
+        wanted[i] = top[i].changes ? narrow_insert(narrow, top[i]) : -1;
+
+    for (DWORD i = 0; i < HWBP_NARROW_SLOTS; i++)
+    {
+        if (wanted[i] == -1 || narrow_slotted(narrow, wanted[i]) != -1)
+            continue;
+
+        // an idle slot, else the one on the least changed word that is no longer wanted
+        HWBP_NARROW_SLOT *slot = NULL;
+
+        for (DWORD s = 0; s < HWBP_NARROW_SLOTS; s++)
+        {
+            HWBP_NARROW_SLOT *other = &narrow->slots[s];
+            LONG current = other->candidate;
+            BOOL keep = FALSE;
+
+            if (!other->count)
+                continue;
+
+            for (DWORD j = 0; current != -1 && j < HWBP_NARROW_SLOTS; j++)
+                keep |= wanted[j] == current;
+
+            if (keep)
+                continue;
+
+            if (current == -1)
+            {
+                slot = other;
+                break;
+            }
+
+            if (!slot || narrow->candidates[current].changes < narrow->candidates[slot->candidate].changes)
+                slot = other;
+        }
+
+        if (!slot)
+            break;
+
+        narrow_move(narrow, slot, wanted[i]);
+    }
+}
+
+static void narrow_scan(PHWBP_REGION region, PVOID *pages, ULONG_PTR count, LPVOID param)
+{
+    PHWBP_NARROW narrow = (PHWBP_NARROW)param;
+    NARROW_WORD top[HWBP_NARROW_SLOTS];
+
+    UNREFERENCED_PARAMETER(region);
+
+    narrow->scan++;
+
+    AcquireSRWLockExclusive(&narrow->lock);
+
+    for (ULONG_PTR i = 0; i < count; i++)
+    {
+        BOOL fresh;
+        HWBP_NARROW_PAGE *page = narrow_page(narrow, (DWORD64)pages[i], &fresh);
+
+        page->dirty++;
+        page->lastScan = narrow->scan;
+
+        if (!fresh)
+            narrow_diff(narrow, page);
+    }
+
+    narrow_top(narrow, top);
+    narrow_place(narrow, top);
+
+    ReleaseSRWLockExclusive(&narrow->lock);
+}
+
+static void NTAPI narrow_thread_callback(PVOID module, DWORD reason, PVOID reserved)
+{
+    UNREFERENCED_PARAMETER(module);
+    UNREFERENCED_PARAMETER(reserved);
+
+    if (reason != DLL_THREAD_ATTACH && reason != DLL_THREAD_DETACH)
+        return;
+
+    DWORD self = GetCurrentThreadId();
+
+    AcquireSRWLockShared(&g_narrows_lock);
+
+    for (PHWBP_NARROW narrow = g_narrows; narrow; narrow = narrow->next)
+    {
+        AcquireSRWLockExclusive(&narrow->lock);
+
+        for (DWORD s = 0; s < HWBP_NARROW_SLOTS; s++)
+        {
+            HWBP_NARROW_SLOT *slot = &narrow->slots[s];
+
+            if (reason == DLL_THREAD_DETACH)
+            {
+                for (DWORD i = 0; i < slot->count; i++)
+                {
+                    if (slot->bps[i]->threadId == self)
+                    {
+                        narrow_drop(slot, i);
+                        break;
+                    }
+                }
+                continue;
+            }
+
+            // a thread that was already running when the narrow was set up has its own
+            PHWBP bp = narrow_covers(slot, self) ? NULL : narrow_add(slot, self);
+
+            if (bp && slot->enabled && !bp_enable(bp))
+                narrow_drop(slot, slot->count - 1);
+        }
+
+        ReleaseSRWLockExclusive(&narrow->lock);
+    }
+
+    ReleaseSRWLockShared(&g_narrows_lock);
+}
+
+PHWBP_NARROW bp_narrow_create(LPVOID base, SIZE_T size, DWORD intervalMs)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    if (!intervalMs)
+        return NULL;
+
+    PHWBP_NARROW narrow = (PHWBP_NARROW)calloc(1, sizeof(HWBP_NARROW));
+    if (!narrow)
+        return NULL;
+
+    InitializeSRWLock(&narrow->lock);
+
+    BOOL ok = TRUE;
+
+    for (DWORD i = 0; ok && i < HWBP_NARROW_PAGES; i++)
+    {
+        narrow->pages[i].snapshot = (BYTE *)malloc(info.dwPageSize);
+        narrow->pages[i].changes = (DWORD *)malloc(info.dwPageSize / sizeof(DWORD64) * sizeof(DWORD));
+        ok = narrow->pages[i].snapshot && narrow->pages[i].changes;
+    }
+
+    for (DWORD s = 0; s < HWBP_NARROW_SLOTS; s++)
+    {
+        narrow->slots[s].narrow = narrow;
+        narrow->slots[s].candidate = -1;
+        narrow->slots[s].target = base;
+    }
+
+    if (!ok)
+    {
+        bp_narrow_destroy(narrow);
+        return NULL;
+    }
+
+    // linked before the snapshot: a thread starting meanwhile either adds itself from
+    // the callback or is found covered there
+    AcquireSRWLockExclusive(&g_narrows_lock);
+    narrow->next = g_narrows;
+    g_narrows = narrow;
+    ReleaseSRWLockExclusive(&g_narrows_lock);
+
+    AcquireSRWLockExclusive(&narrow->lock);
+
+    for (DWORD s = 0; ok && s < HWBP_NARROW_SLOTS; s++)
+        ok = narrow_sync(&narrow->slots[s]);
+
+    ReleaseSRWLockExclusive(&narrow->lock);
+
+    if (ok)
+    {
+        narrow->region = bp_region_watch(base, size, intervalMs, narrow_scan, narrow);
+        ok = narrow->region != NULL;
+    }
+
+    if (!ok)
+    {
+        bp_narrow_destroy(narrow);
+        return NULL;
+    }
+
+    return narrow;
+}
+
+void bp_narrow_destroy(PHWBP_NARROW narrow)
+{
+    AcquireSRWLockExclusive(&g_narrows_lock);
+
+    for (PHWBP_NARROW *link = &g_narrows; *link; link = &(*link)->next)
+    {
+        if (*link == narrow)
+        {
+            *link = narrow->next;
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_narrows_lock);
+
+    if (narrow->region)
+        bp_region_unwatch(narrow->region);
+
+    for (DWORD s = 0; s < HWBP_NARROW_SLOTS; s++)
+    {
+        HWBP_NARROW_SLOT *slot = &narrow->slots[s];
+
+        if (slot->enabled)
+            bp_disable_batch(slot->bps, slot->count);
+
+        for (DWORD i = 0; i < slot->count; i++)
+            bp_destroy(slot->bps[i]);
+
+        free(slot->bps);
+    }
+
+    for (DWORD i = 0; i < HWBP_NARROW_PAGES; i++)
+    {
+        free(narrow->pages[i].snapshot);
+        free(narrow->pages[i].changes);
+    }
+
+    free(narrow);
+}
+
+static int narrow_compare(const void *a, const void *b)
+{
+    const HWBP_NARROW_CANDIDATE *x = (const HWBP_NARROW_CANDIDATE *)a;
+    const HWBP_NARROW_CANDIDATE *y = (const HWBP_NARROW_CANDIDATE *)b;
+
+    if (x->hits != y->hits)
+        return x->hits > y->hits ? -1 : 1;
+    if (x->changes != y->changes)
+        return x->changes > y->changes ? -1 : 1;
+
+    return 0;
+}
+
+DWORD bp_narrow_report(PHWBP_NARROW narrow, PHWBP_NARROW_CANDIDATE candidates, DWORD max)
+{
+    HWBP_NARROW_CANDIDATE all[HWBP_NARROW_CANDIDATES];
+
+    AcquireSRWLockShared(&narrow->lock);
+    DWORD count = narrow->candidateCount;
+    memcpy(all, narrow->candidates, count * sizeof(HWBP_NARROW_CANDIDATE));
+    ReleaseSRWLockShared(&narrow->lock);
+
+    qsort(all, count, sizeof(HWBP_NARROW_CANDIDATE), narrow_compare);
+
+    count = min(count, max);
+    memcpy(candidates, all, count * sizeof(HWBP_NARROW_CANDIDATE));
+
+    return count;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+#include "region.h"
+
+// Finds who writes somewhere in a large region in two steps. Page-level write watch
+// (HWBP_REGION) finds the written pages each interval at no cost to the writers; the
+// most often written pages are then diffed word by word against a copy, and the four
+// debug registers are moved onto the 8-byte words that change most often, where a
+// write is caught with the writing thread and instruction pointer.
+//
+// A page is copied the first time it is seen written, so its words are only ranked
+// from the second interval in which it is written again.
+//
+// Every thread gets a breakpoint per slot: the threads that exist at creation, and
+// threads started later from a TLS callback, which also drops those of exiting threads.
+// A thread that exits without it (TerminateThread) only loses its own breakpoint when
+// the slot next moves, and a move that fails rebuilds the set from a fresh thread list.
+
+#define HWBP_NARROW_SLOTS 4
+#define HWBP_NARROW_PAGES 64 // pages diffed word by word
+#define HWBP_NARROW_CANDIDATES 32
+#define HWBP_NARROW_IPS 4
+
+typedef struct _HWBP_NARROW_IP
+{
+    volatile DWORD64 ip;
+    volatile LONG64 count;
+} HWBP_NARROW_IP;
+
+typedef struct _HWBP_NARROW_CANDIDATE
+{
+    DWORD64 address; // 8-byte aligned
+    LONG64 changes;  // intervals in which the word's value changed
+    volatile LONG64 hits; // writes caught by a debug register
+    volatile DWORD lastThread;
+    HWBP_NARROW_IP ips[HWBP_NARROW_IPS]; // first writers seen, further ones only count in hits
+} HWBP_NARROW_CANDIDATE, *PHWBP_NARROW_CANDIDATE;
+
+typedef struct _HWBP_NARROW_PAGE
+{
+    DWORD64 address; // 0 when free
+    LONG64 dirty;    // intervals in which the page was written
+    LONG64 lastScan;
+    BYTE *snapshot;
+    DWORD *changes; // per word
+} HWBP_NARROW_PAGE;
+
+typedef struct _HWBP_NARROW HWBP_NARROW, *PHWBP_NARROW;
+
+typedef struct _HWBP_NARROW_SLOT
+{
+    PHWBP_NARROW narrow;
+    volatile LONG candidate; // -1 while the slot watches nothing
+    LPVOID target;           // where the breakpoints point, also for threads joining later
+    PHWBP *bps; // one per thread
+    DWORD count;
+    DWORD capacity;
+    BOOL enabled;
+} HWBP_NARROW_SLOT;
+
+struct _HWBP_NARROW
+{
+    PHWBP_REGION region;
+    LONG64 scan;
+    HWBP_NARROW_PAGE pages[HWBP_NARROW_PAGES];
+    SRWLOCK lock; // candidate table and slots, against bp_narrow_report and thread start/exit
+    HWBP_NARROW_CANDIDATE candidates[HWBP_NARROW_CANDIDATES];
+    DWORD candidateCount;
+    HWBP_NARROW_SLOT slots[HWBP_NARROW_SLOTS];
+    PHWBP_NARROW next;
+};
+
+EXTERN_C_START
+
+// base/size as for bp_region_watch.
+PHWBP_NARROW bp_narrow_create(LPVOID base, SIZE_T size, DWORD intervalMs);
+void bp_narrow_destroy(PHWBP_NARROW narrow);
+
+// Copies up to max candidates, those caught by a debug register first, then by changes.
+// Returns the number copied.
+DWORD bp_narrow_report(PHWBP_NARROW narrow, PHWBP_NARROW_CANDIDATE candidates, DWORD max);
+
+EXTERN_C_END
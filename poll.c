@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <immintrin.h>
+#include "poll.h"
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+// The AVX2 kernel is only ever called after the runtime check, the rest of the file
+// must not be compiled for AVX2. MSVC accepts the intrinsics without a switch.
+#if defined(__GNUC__)
+#define POLL_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define POLL_AVX2_TARGET
+#endif
+
+// Each kernel reads the words at addresses, and for each that differs from values
+// records its index in changed and its previous value in old, then stores the new one.
+typedef SIZE_T (*POLL_KERNEL)(const DWORD64 *addresses, DWORD64 *values, SIZE_T count, SIZE_T *changed, DWORD64 *old);
+
+static SIZE_T poll_scalar(const DWORD64 *addresses, DWORD64 *values, SIZE_T count, SIZE_T *changed, DWORD64 *old)
+{
+    SIZE_T n = 0;
+
+    for (SIZE_T i = 0; i < count; i++)
+    {
+        DWORD64 now = *(const volatile DWORD64 *)addresses[i];
+
+        if (now != values[i])
+        {
+            changed[n] = i;
+            old[n++] = values[i];
+            values[i] = now;
+        }
+    }
+
+    return n;
+}
+
+static SIZE_T poll_sse2(const DWORD64 *addresses, DWORD64 *values, SIZE_T count, SIZE_T *changed, DWORD64 *old)
+{
+    SIZE_T n = 0, i = 0;
+
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i now = _mm_set_epi64x(*(const volatile LONG64 *)addresses[i + 1], *(const volatile LONG64 *)addresses[i]);
+        __m128i then = _mm_loadu_si128((const __m128i *)(values + i));
+
+        // no 64-bit compare in SSE2, a lane is equal when all of its bytes are
+        int same = _mm_movemask_epi8(_mm_cmpeq_epi32(now, then));
+        if (same == 0xffff)
+            continue;
+
+        DWORD64 lanes[2];
+        _mm_storeu_si128((__m128i *)lanes, now);
+
+        for (int l = 0; l < 2; l++)
+        {
+            if (((same >> (l * 8)) & 0xff) != 0xff)
+            {
+                changed[n] = i + l;
+                old[n++] = values[i + l];
+                values[i + l] = lanes[l];
+            }
+        }
+    }
+
+    SIZE_T tail = poll_scalar(addresses + i, values + i, count - i, changed + n, old + n);
+    for (SIZE_T t = 0; t < tail; t++)
+        changed[n + t] += i;
+
+    return n + tail;
+}
+
+POLL_AVX2_TARGET static SIZE_T poll_avx2(const DWORD64 *addresses, DWORD64 *values, SIZE_T count, SIZE_T *changed, DWORD64 *old)
+{
+    SIZE_T n = 0, i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        // the addresses are the gather indices from a zero base
+        __m256i index = _mm256_loadu_si256((const __m256i *)(addresses + i));
+        __m256i now = _mm256_i64gather_epi64((const long long *)0, index, 1);
+        __m256i then = _mm256_loadu_si256((const __m256i *)(values + i));
+
+        int same = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(now, then)));
+        if (same == 0xf)
+            continue;
+
+        DWORD64 lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, now);
+
+        for (int l = 0; l < 4; l++)
+        {
+            if (!(same & (1 << l)))
+            {
+                changed[n] = i + l;
+                old[n++] = values[i + l];
+                values[i + l] = lanes[l];
+            }
+        }
+    }
+
+    SIZE_T tail = poll_scalar(addresses + i, values + i, count - i, changed + n, old + n);
+    for (SIZE_T t = 0; t < tail; t++)
+        changed[n + t] += i;
+
+    return n + tail;
+}
+
+static const POLL_KERNEL g_kernels[] = {poll_scalar, poll_sse2, poll_avx2};
+
+SIZE_T bp_poll_scan(PHWBP_POLL poll)
+{
+    HWBP_POLL_CHANGE change;
+
+    AcquireSRWLockShared(&poll->lock);
+
+    SIZE_T n = g_kernels[poll->kernel](poll->addresses, poll->values, poll->count, poll->changed, poll->old);
+
+    QueryPerformanceCounter(&change.timestamp);
+
+    for (SIZE_T i = 0; i < n; i++)
+    {
+        change.address = poll->addresses[poll->changed[i]];
+        change.oldValue = poll->old[i];
+        change.newValue = poll->values[poll->changed[i]];
+        bp_ring_push(poll->changes, &change);
+    }
+
+    ReleaseSRWLockShared(&poll->lock);
+
+    InterlockedIncrement64(&poll->scans);
+
+    return n;
+}
+
+static DWORD WINAPI poll_thread(LPVOID param)
+{
+    PHWBP_POLL poll = (PHWBP_POLL)param;
+
+    while (WaitForSingleObject(poll->hStop, poll->interval) == WAIT_TIMEOUT)
+        bp_poll_scan(poll);
+
+    return 0;
+}
+
+PHWBP_POLL bp_poll_create(DWORD intervalMs, SIZE_T capacity)
+{
+    PHWBP_POLL poll = (PHWBP_POLL)calloc(1, sizeof(HWBP_POLL));
+    if (!poll)
+        return NULL;
+
+    InitializeSRWLock(&poll->lock);
+    poll->interval = intervalMs;
+    poll->kernel = IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE) ? POLL_AVX2 : POLL_SSE2;
+    poll->changes = bp_ring_create(sizeof(HWBP_POLL_CHANGE), capacity);
+
+    BOOL ok = poll->changes != NULL;
+
+    if (ok && intervalMs)
+    {
+        poll->hStop = CreateEventA(NULL, TRUE, FALSE, NULL);
+        poll->hThread = poll->hStop ? CreateThread(NULL, 0, poll_thread, poll, 0, NULL) : NULL;
+        ok = poll->hThread != NULL;
+    }
+
+    if (!ok)
+    {
+        bp_poll_destroy(poll);
+        return NULL;
+    }
+
+    return poll;
+}
+
+void bp_poll_destroy(PHWBP_POLL poll)
+{
+    if (poll->hThread)
+    {
+        SetEvent(poll->hStop);
+        WaitForSingleObject(poll->hThread, INFINITE);
+        CloseHandle(poll->hThread);
+    }
+
+    if (poll->hStop)
+        CloseHandle(poll->hStop);
+    if (poll->changes)
+        bp_ring_destroy(poll->changes);
+
+    free(poll->addresses);
+    free(poll->values);
+    free(poll->changed);
+    free(poll->old);
+    free(poll);
+}
+
+static BOOL poll_readable(LPVOID address)
+{
+    MEMORY_BASIC_INFORMATION mbi;
+    DWORD readable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY |
+                     PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+    if (!VirtualQuery(address, &mbi, sizeof(mbi)) || mbi.State != MEM_COMMIT)
+        return FALSE;
+
+    // the whole word within the region, and no guard page to trip
+    return (mbi.Protect & readable) && !(mbi.Protect & PAGE_GUARD) &&
+           (ULONG_PTR)address + sizeof(DWORD64) <= (ULONG_PTR)mbi.BaseAddress + mbi.RegionSize;
+}
+
+static BOOL poll_grow(PHWBP_POLL poll)
+{
+    SIZE_T capacity = poll->capacity ? poll->capacity * 2 : 256;
+
+    DWORD64 *addresses = (DWORD64 *)realloc(poll->addresses, capacity * sizeof(DWORD64));
+    if (addresses)
+        poll->addresses = addresses;
+
+    DWORD64 *values = (DWORD64 *)realloc(poll->values, capacity * sizeof(DWORD64));
+    if (values)
+        poll->values = values;
+
+    SIZE_T *changed = (SIZE_T *)realloc(poll->changed, capacity * sizeof(SIZE_T));
+    if (changed)
+        poll->changed = changed;
+
+    DWORD64 *old = (DWORD64 *)realloc(poll->old, capacity * sizeof(DWORD64));
+    if (old)
+        poll->old = old;
+
+    if (!addresses || !values || !changed || !old)
+        return FALSE;
+
+    poll->capacity = capacity;
+    return TRUE;
+}
+
+BOOL bp_poll_add(PHWBP_POLL poll, LPVOID address)
+{
+    if (!poll_readable(address))
+        return FALSE;
+
+    AcquireSRWLockExclusive(&poll->lock);
+
+    BOOL ok = poll->count < poll->capacity || poll_grow(poll);
+
+    if (ok)
+    {
+        poll->addresses[poll->count] = (DWORD64)address;
+        poll->values[poll->count] = *(const volatile DWORD64 *)address;
+        poll->count++;
+    }
+
+    ReleaseSRWLockExclusive(&poll->lock);
+
+    return ok;
+}
+
+BOOL bp_poll_remove(PHWBP_POLL poll, LPVOID address)
+{
+    BOOL found = FALSE;
+
+    AcquireSRWLockExclusive(&poll->lock);
+
+    for (SIZE_T i = 0; i < poll->count; i++)
+    {
+        if (poll->addresses[i] != (DWORD64)address)
+            continue;
+
+        // order does not matter to the kernels, the last word takes the hole
+        poll->count--;
+        poll->addresses[i] = poll->addresses[poll->count];
+        poll->values[i] = poll->values[poll->count];
+        found = TRUE;
+        break;
+    }
+
+    ReleaseSRWLockExclusive(&poll->lock);
+
+    return found;
+}
+
+BOOL bp_poll_read(PHWBP_POLL poll, PHWBP_POLL_CHANGE change)
+{
+    return bp_ring_pop(poll->changes, change);
+}
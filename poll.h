@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Windows.h>
+#include "ring.h"
+
+// Software watch for targets too many for the debug registers that can tolerate being
+// noticed late. A background thread reads every watched 8-byte word each interval and
+// compares it with the value it read last time, with an AVX2 gather kernel, an SSE2
+// kernel or plain loads, picked at creation from what the processor supports.
+//
+// A word changed and changed back within one interval goes unnoticed, and the writer
+// is never known: keep the hardware slots for targets where either matters.
+
+typedef enum _HWBP_POLL_KERNEL
+{
+    POLL_SCALAR,
+    POLL_SSE2,
+    POLL_AVX2
+} HWBP_POLL_KERNEL;
+
+typedef struct _HWBP_POLL_CHANGE
+{
+    LARGE_INTEGER timestamp; // QueryPerformanceCounter at the scan that saw it
+    DWORD64 address;
+    DWORD64 oldValue;
+    DWORD64 newValue;
+} HWBP_POLL_CHANGE, *PHWBP_POLL_CHANGE;
+
+typedef struct _HWBP_POLL
+{
+    HWBP_POLL_KERNEL kernel;
+    DWORD interval;
+    SRWLOCK lock; // the word arrays, scans share it
+    DWORD64 *addresses;
+    DWORD64 *values;
+    SIZE_T count;
+    SIZE_T capacity;
+    SIZE_T *changed; // scan scratch, capacity entries each
+    DWORD64 *old;
+    PHWBP_RING changes;
+    HANDLE hThread;
+    HANDLE hStop;
+    volatile LONG64 scans;
+} HWBP_POLL, *PHWBP_POLL;
+
+EXTERN_C_START
+
+// capacity is the number of changes buffered until read. With intervalMs 0 no thread
+// is started and the caller scans.
+PHWBP_POLL bp_poll_create(DWORD intervalMs, SIZE_T capacity);
+void bp_poll_destroy(PHWBP_POLL poll);
+
+// The word must be committed and readable, and stay so until removed.
+BOOL bp_poll_add(PHWBP_POLL poll, LPVOID address);
+BOOL bp_poll_remove(PHWBP_POLL poll, LPVOID address);
+
+// Returns the number of words that changed since the previous scan. One scanner at a
+// time: the scan thread, or the caller when there is none.
+SIZE_T bp_poll_scan(PHWBP_POLL poll);
+
+BOOL bp_poll_read(PHWBP_POLL poll, PHWBP_POLL_CHANGE change);
+
+EXTERN_C_END
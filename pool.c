@@ -0,0 +1,128 @@
+#include <malloc.h>
+#include "pool.h"
+
+typedef struct _HWBP_POOL_BLOCK
+{
+    struct _HWBP_POOL_BLOCK *next;
+} HWBP_POOL_BLOCK, *PHWBP_POOL_BLOCK;
+
+static volatile LONG g_pool_ids = 0; // bit per cache index in use
+static volatile LONG64 g_pool_serial = 0;
+
+static __declspec(thread) PHWBP_POOL_BLOCK t_cache[HWBP_POOL_MAX];
+static __declspec(thread) DWORD t_cached[HWBP_POOL_MAX];
+static __declspec(thread) LONG64 t_serial[HWBP_POOL_MAX];
+
+static LONG claim_id(void)
+{
+    for (LONG id = 0; id < HWBP_POOL_MAX; id++)
+    {
+        if (!InterlockedBitTestAndSet(&g_pool_ids, id))
+            return id;
+    }
+
+    return -1;
+}
+
+// This thread's cache for pool, emptied first if it was left by a destroyed pool with
+// the same id: its blocks were in a released slab.
+static BOOL own_cache(PHWBP_POOL pool)
+{
+    if (pool->id == -1)
+        return FALSE;
+
+    if (t_serial[pool->id] != pool->serial)
+    {
+        t_cache[pool->id] = NULL;
+        t_cached[pool->id] = 0;
+        t_serial[pool->id] = pool->serial;
+    }
+
+    return TRUE;
+}
+
+PHWBP_POOL bp_pool_create(SIZE_T blockSize, DWORD blocks)
+{
+    PHWBP_POOL pool = (PHWBP_POOL)_aligned_malloc(sizeof(HWBP_POOL), MEMORY_ALLOCATION_ALIGNMENT);
+    if (!pool)
+        return NULL;
+
+    // free blocks double as SLIST entries
+    pool->blockSize = blockSize;
+    pool->stride = (max(blockSize, sizeof(SLIST_ENTRY)) + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(SIZE_T)(MEMORY_ALLOCATION_ALIGNMENT - 1);
+    pool->blocks = blocks;
+    pool->exhausted = 0;
+    pool->slab = (BYTE *)VirtualAlloc(NULL, pool->stride * blocks, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!pool->slab)
+    {
+        _aligned_free(pool);
+        return NULL;
+    }
+
+    pool->id = claim_id();
+    pool->serial = InterlockedIncrement64(&g_pool_serial);
+    pool->cached = 0;
+    pool->cacheLimit = (LONG)(blocks / 4);
+
+    InitializeSListHead(&pool->global);
+    for (DWORD i = blocks; i-- > 0;)
+        InterlockedPushEntrySList(&pool->global, (PSLIST_ENTRY)(pool->slab + i * pool->stride));
+
+    return pool;
+}
+
+void bp_pool_destroy(PHWBP_POOL pool)
+{
+    // other threads notice the new serial when the id is reused, this one clears it now
+    if (pool->id != -1)
+    {
+        t_cache[pool->id] = NULL;
+        t_cached[pool->id] = 0;
+        InterlockedBitTestAndReset(&g_pool_ids, pool->id);
+    }
+
+    VirtualFree(pool->slab, 0, MEM_RELEASE);
+    _aligned_free(pool);
+}
+
+void *bp_pool_alloc(PHWBP_POOL pool)
+{
+    if (own_cache(pool) && t_cache[pool->id])
+    {
+        PHWBP_POOL_BLOCK block = t_cache[pool->id];
+        t_cache[pool->id] = block->next;
+        t_cached[pool->id]--;
+        InterlockedDecrement(&pool->cached);
+        return block;
+    }
+
+    void *block = InterlockedPopEntrySList(&pool->global);
+    if (!block)
+        InterlockedIncrement64(&pool->exhausted);
+
+    return block;
+}
+
+void bp_pool_free(PHWBP_POOL pool, void *block)
+{
+    if (!block)
+        return;
+
+    // keep it only while the caches of all threads together stay under their share
+    if (own_cache(pool) && t_cached[pool->id] < HWBP_POOL_THREAD_CACHE)
+    {
+        if (InterlockedIncrement(&pool->cached) <= pool->cacheLimit)
+        {
+            PHWBP_POOL_BLOCK cached = (PHWBP_POOL_BLOCK)block;
+            cached->next = t_cache[pool->id];
+            t_cache[pool->id] = cached;
+            t_cached[pool->id]++;
+            return;
+        }
+
+        InterlockedDecrement(&pool->cached);
+    }
+
+    InterlockedPushEntrySList(&pool->global, (PSLIST_ENTRY)block);
+}
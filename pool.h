@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Windows.h>
+
+// Fixed-size block allocator for breakpoint callbacks. A callback runs on whatever
+// thread hit the breakpoint, possibly in the middle of a heap operation holding the
+// heap lock, so it must not call malloc. Blocks come from one preallocated slab: each
+// thread keeps a few freed blocks in a static TLS cache (no locking, no TLS slot
+// allocation), the rest sit in a lock-free global SLIST.
+//
+// The library's own callbacks keep to the same rule and make no exception: whatever they
+// allocate comes from a pool, and whatever they retire is freed later by a thread of
+// their own (the gdb stub's retired breakpoints, destroyed by its server thread).
+//
+// A thread that exits keeps its cached blocks until the pool is destroyed, so all
+// caches together hold at most a quarter of the pool; past that freed blocks go
+// straight back to the global list and new threads still find blocks there.
+
+#define HWBP_POOL_MAX 16 // live pools with a per-thread cache, further ones use the global list only
+#define HWBP_POOL_THREAD_CACHE 8
+
+typedef struct _HWBP_POOL
+{
+    SLIST_HEADER global;
+    SIZE_T blockSize;
+    SIZE_T stride;
+    DWORD blocks;
+    LONG id;       // per-thread cache index, -1 if none, reused once the pool is destroyed
+    LONG64 serial; // tells a thread's cache for this pool from one left by an earlier owner of id
+    volatile LONG cached;
+    LONG cacheLimit;
+    BYTE *slab;
+    volatile LONG64 exhausted;
+} HWBP_POOL, *PHWBP_POOL;
+
+EXTERN_C_START
+
+PHWBP_POOL bp_pool_create(SIZE_T blockSize, DWORD blocks);
+
+// Blocks cached by threads still running are reclaimed with the slab.
+void bp_pool_destroy(PHWBP_POOL pool);
+
+// Safe in breakpoint callbacks. NULL when every block is in use.
+void *bp_pool_alloc(PHWBP_POOL pool);
+void bp_pool_free(PHWBP_POOL pool, void *block);
+
+EXTERN_C_END
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include "region.h"
+
+LPVOID bp_region_alloc(SIZE_T size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_WRITE_WATCH, PAGE_READWRITE);
+}
+
+void bp_region_free(LPVOID base)
+{
+    VirtualFree(base, 0, MEM_RELEASE);
+}
+
+static BOOL region_collect(PHWBP_REGION region, ULONG_PTR *count)
+{
+    ULONG_PTR n = region->size / region->pageSize;
+    ULONG granularity;
+
+    if (GetWriteWatch(WRITE_WATCH_FLAG_RESET, region->base, region->size, region->pages, &n, &granularity) != 0)
+        return FALSE;
+
+    *count = n;
+    return TRUE;
+}
+
+BOOL bp_region_scan(PHWBP_REGION region, ULONG_PTR *count)
+{
+    ULONG_PTR n;
+
+    if (!region_collect(region, &n))
+        return FALSE;
+
+    InterlockedIncrement64(&region->scans);
+    InterlockedExchangeAdd64(&region->dirty, (LONG64)n);
+
+    if (n && region->callback)
+        region->callback(region, region->pages, n, region->param);
+
+    if (count)
+        *count = n;
+
+    return TRUE;
+}
+
+static DWORD WINAPI region_thread(LPVOID param)
+{
+    PHWBP_REGION region = (PHWBP_REGION)param;
+
+    while (WaitForSingleObject(region->hStop, region->interval) == WAIT_TIMEOUT)
+        bp_region_scan(region, NULL);
+
+    return 0;
+}
+
+PHWBP_REGION bp_region_watch(LPVOID base, SIZE_T size, DWORD intervalMs, PHWBP_REGION_CALLBACK callback, LPVOID param)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    ULONG_PTR start = (ULONG_PTR)base & ~((ULONG_PTR)info.dwPageSize - 1);
+    ULONG_PTR end = ((ULONG_PTR)base + size + info.dwPageSize - 1) & ~((ULONG_PTR)info.dwPageSize - 1);
+
+    if (!size || end <= start)
+        return NULL;
+
+    PHWBP_REGION region = (PHWBP_REGION)calloc(1, sizeof(HWBP_REGION));
+    if (!region)
+        return NULL;
+
+    region->base = (LPVOID)start;
+    region->size = end - start;
+    region->pageSize = info.dwPageSize;
+    region->interval = intervalMs;
+    region->callback = callback;
+    region->param = param;
+    region->pages = (PVOID *)malloc(region->size / region->pageSize * sizeof(PVOID));
+
+    // fails unless the range is write watched, and drops what was written before the watch
+    ULONG_PTR ignored;
+    BOOL ok = region->pages && region_collect(region, &ignored);
+
+    if (ok && intervalMs)
+    {
+        region->hStop = CreateEventA(NULL, TRUE, FALSE, NULL);
+        region->hThread = region->hStop ? CreateThread(NULL, 0, region_thread, region, 0, NULL) : NULL;
+        ok = region->hThread != NULL;
+    }
+
+    if (!ok)
+    {
+        bp_region_unwatch(region);
+        return NULL;
+    }
+
+    return region;
+}
+
+void bp_region_unwatch(PHWBP_REGION region)
+{
+    if (region->hThread)
+    {
+        SetEvent(region->hStop);
+        WaitForSingleObject(region->hThread, INFINITE);
+        CloseHandle(region->hThread);
+    }
+
+    if (region->hStop)
+        CloseHandle(region->hStop);
+
+    free(region->pages);
+    free(region);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Windows.h>
+
+// Write tracking for regions far larger than the four debug registers can cover.
+// The region must be allocated with MEM_WRITE_WATCH (bp_region_alloc); the kernel
+// then records dirty pages itself, so a writing thread takes no exception and no
+// protection change. A background thread collects and resets the dirty pages with
+// GetWriteWatch every interval and hands them to the callback.
+//
+// Resolution is a page per interval: several writes to one page between two scans
+// are reported once, and the writer and instruction are not known.
+
+typedef struct _HWBP_REGION HWBP_REGION, *PHWBP_REGION;
+
+// pages are page-aligned addresses, valid for the duration of the call only
+typedef void (*PHWBP_REGION_CALLBACK)(PHWBP_REGION region, PVOID *pages, ULONG_PTR count, LPVOID param);
+
+struct _HWBP_REGION
+{
+    LPVOID base;
+    SIZE_T size;
+    DWORD pageSize;
+    DWORD interval;
+    PHWBP_REGION_CALLBACK callback;
+    LPVOID param;
+    PVOID *pages; // one entry per page of the region
+    HANDLE hThread;
+    HANDLE hStop;
+    volatile LONG64 scans;
+    volatile LONG64 dirty; // pages reported
+};
+
+EXTERN_C_START
+
+// Committed read/write memory with write tracking on. Only such allocations can be watched.
+LPVOID bp_region_alloc(SIZE_T size);
+void bp_region_free(LPVOID base);
+
+// base and size are rounded out to pages and must lie within one bp_region_alloc
+// allocation. With intervalMs 0 no thread is started and the caller scans.
+PHWBP_REGION bp_region_watch(LPVOID base, SIZE_T size, DWORD intervalMs, PHWBP_REGION_CALLBACK callback, LPVOID param);
+void bp_region_unwatch(PHWBP_REGION region);
+
+// Collects and resets the pages written since the last scan, then calls the callback.
+// Not to be mixed with a running scan thread.
+BOOL bp_region_scan(PHWBP_REGION region, ULONG_PTR *count);
+
+EXTERN_C_END
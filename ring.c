@@ -0,0 +1,103 @@
+#include <malloc.h>
+#include <string.h>
+#include "ring.h"
+
+// Each cell is a sequence number followed by the element. A cell at position pos is
+// free for a producer when seq == pos and holds data for a consumer when seq == pos + 1.
+#define CELL_SEQ(ring, pos) ((volatile LONG64 *)((ring)->cells + ((pos) & (ring)->mask) * (ring)->stride))
+#define CELL_DATA(ring, pos) ((BYTE *)CELL_SEQ(ring, pos) + sizeof(LONG64))
+
+PHWBP_RING bp_ring_create(SIZE_T elementSize, SIZE_T capacity)
+{
+    SIZE_T size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    SIZE_T stride = (sizeof(LONG64) + elementSize + 7) & ~(SIZE_T)7;
+
+    PHWBP_RING ring = (PHWBP_RING)_aligned_malloc(sizeof(HWBP_RING) + size * stride, 64);
+    if (!ring)
+        return NULL;
+
+    ring->elementSize = elementSize;
+    ring->stride = stride;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+
+    for (SIZE_T i = 0; i < size; i++)
+        *CELL_SEQ(ring, i) = (LONG64)i;
+
+    return ring;
+}
+
+void bp_ring_destroy(PHWBP_RING ring)
+{
+    _aligned_free(ring);
+}
+
+BOOL bp_ring_push(PHWBP_RING ring, const void *element)
+{
+    LONG64 pos = ring->head;
+
+    for (;;)
+    {
+        LONG64 diff = *CELL_SEQ(ring, pos) - pos;
+
+        if (diff == 0)
+        {
+            LONG64 seen = InterlockedCompareExchange64(&ring->head, pos + 1, pos);
+            if (seen == pos)
+                break;
+            pos = seen;
+        }
+        else if (diff < 0)
+        {
+            InterlockedIncrement64(&ring->dropped);
+            return FALSE; // full
+        }
+        else
+        {
+            pos = ring->head;
+        }
+    }
+
+    memcpy(CELL_DATA(ring, pos), element, ring->elementSize);
+    MemoryBarrier();
+    *CELL_SEQ(ring, pos) = pos + 1;
+
+    return TRUE;
+}
+
+BOOL bp_ring_pop(PHWBP_RING ring, void *element)
+{
+    LONG64 pos = ring->tail;
+
+    for (;;)
+    {
+        LONG64 diff = *CELL_SEQ(ring, pos) - (pos + 1);
+
+        if (diff == 0)
+        {
+            LONG64 seen = InterlockedCompareExchange64(&ring->tail, pos + 1, pos);
+            if (seen == pos)
+                break;
+            pos = seen;
+        }
+        else if (diff < 0)
+        {
+            return FALSE; // empty
+        }
+        else
+        {
+            pos = ring->tail;
+        }
+    }
+
+    memcpy(element, CELL_DATA(ring, pos), ring->elementSize);
+    MemoryBarrier();
+    *CELL_SEQ(ring, pos) = pos + (LONG64)ring->mask + 1;
+
+    return TRUE;
+}
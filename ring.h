@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Windows.h>
+#include <stdint.h>
+
+// Bounded multi-producer/multi-consumer ring of fixed-size elements.
+// Push never blocks or allocates, so it is usable from breakpoint callbacks.
+typedef struct _HWBP_RING
+{
+    SIZE_T elementSize;
+    SIZE_T stride;
+    SIZE_T mask;
+    DECLSPEC_ALIGN(64) volatile LONG64 head;
+    DECLSPEC_ALIGN(64) volatile LONG64 tail;
+    DECLSPEC_ALIGN(64) volatile LONG64 dropped;
+    DECLSPEC_ALIGN(64) BYTE cells[1];
+} HWBP_RING, *PHWBP_RING;
+
+EXTERN_C_START
+
+// capacity is rounded up to a power of two
+PHWBP_RING bp_ring_create(SIZE_T elementSize, SIZE_T capacity);
+void bp_ring_destroy(PHWBP_RING ring);
+BOOL bp_ring_push(PHWBP_RING ring, const void *element);
+BOOL bp_ring_pop(PHWBP_RING ring, void *element);
+
+EXTERN_C_END
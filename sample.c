@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sample.h"
+
+#define HWBP_SAMPLER_SCRATCH 64 // samples being filled at once, i.e. threads hitting simultaneously
+
+static void sampler_hit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    PHWBP_SAMPLER sampler = (PHWBP_SAMPLER)param;
+
+    // the stack slice can be large, keep it off the hitting thread's stack
+    PHWBP_SAMPLE sample = (PHWBP_SAMPLE)bp_pool_alloc(sampler->pool);
+    if (!sample)
+    {
+        InterlockedIncrement64(&sampler->ring->dropped);
+        return;
+    }
+
+    sample->bp = bp;
+    sample->threadId = bp->threadId;
+    sample->eflags = ctx->EFlags;
+    QueryPerformanceCounter(&sample->timestamp);
+    sample->rip = ctx->Rip;
+    sample->rsp = ctx->Rsp;
+    sample->rbp = ctx->Rbp;
+    sample->rax = ctx->Rax;
+    sample->rbx = ctx->Rbx;
+    sample->rcx = ctx->Rcx;
+    sample->rdx = ctx->Rdx;
+    sample->rsi = ctx->Rsi;
+    sample->rdi = ctx->Rdi;
+    sample->r8 = ctx->R8;
+    sample->r9 = ctx->R9;
+    sample->r10 = ctx->R10;
+    sample->r11 = ctx->R11;
+    sample->r12 = ctx->R12;
+    sample->r13 = ctx->R13;
+    sample->r14 = ctx->R14;
+    sample->r15 = ctx->R15;
+    memcpy(sample->xmm, &ctx->Xmm0, sizeof(sample->xmm));
+
+    // never read past the top of the hitting thread's stack
+    ULONG_PTR low, high;
+    GetCurrentThreadStackLimits(&low, &high);
+
+    DWORD size = 0;
+    if (ctx->Rsp >= low && ctx->Rsp < high)
+        size = (DWORD)min((DWORD64)sampler->stackSize, high - ctx->Rsp);
+
+    memcpy(sample->stack, (LPCVOID)ctx->Rsp, size);
+    sample->stackSize = size;
+
+    bp_ring_push(sampler->ring, sample);
+    bp_pool_free(sampler->pool, sample);
+}
+
+PHWBP_SAMPLER bp_sampler_create(DWORD stackSize, SIZE_T capacity)
+{
+    PHWBP_SAMPLER sampler = (PHWBP_SAMPLER)malloc(sizeof(HWBP_SAMPLER));
+    if (!sampler)
+        return NULL;
+
+    sampler->stackSize = stackSize;
+    sampler->sampleSize = FIELD_OFFSET(HWBP_SAMPLE, stack) + max(stackSize, 1);
+    sampler->ring = bp_ring_create(sampler->sampleSize, capacity);
+    sampler->pool = bp_pool_create(sampler->sampleSize, HWBP_SAMPLER_SCRATCH);
+
+    if (!sampler->ring || !sampler->pool)
+    {
+        if (sampler->ring)
+            bp_ring_destroy(sampler->ring);
+        if (sampler->pool)
+            bp_pool_destroy(sampler->pool);
+        free(sampler);
+        return NULL;
+    }
+
+    return sampler;
+}
+
+void bp_sampler_destroy(PHWBP_SAMPLER sampler)
+{
+    bp_ring_destroy(sampler->ring);
+    bp_pool_destroy(sampler->pool);
+    free(sampler);
+}
+
+BOOL bp_sampler_attach(PHWBP_SAMPLER sampler, PHWBP bp)
+{
+    return bp_set_callback(bp, sampler_hit, sampler);
+}
+
+BOOL bp_sampler_read(PHWBP_SAMPLER sampler, PHWBP_SAMPLE sample)
+{
+    return bp_ring_pop(sampler->ring, sample);
+}
+
+BOOL bp_sample_arg(PHWBP_SAMPLE sample, uint8_t index, HWBP_ARG_TYPE type, void *value)
+{
+    DWORD64 raw;
+
+    if ((type == HWBP_ARG_FLOAT || type == HWBP_ARG_DOUBLE) && index < 4)
+    {
+        raw = sample->xmm[index].Low;
+    }
+    else if (index < 4)
+    {
+        DWORD64 regs[4] = {sample->rcx, sample->rdx, sample->r8, sample->r9};
+        raw = regs[index];
+    }
+    else
+    {
+        // [rsp] is the return address, followed by the 32 byte home area
+        SIZE_T offset = (SIZE_T)(index + 1) * sizeof(DWORD64);
+        if (offset + sizeof(DWORD64) > sample->stackSize)
+            return FALSE;
+
+        memcpy(&raw, sample->stack + offset, sizeof(raw));
+    }
+
+    switch (type)
+    {
+    case HWBP_ARG_INT32:
+    case HWBP_ARG_UINT32:
+    case HWBP_ARG_FLOAT:
+        memcpy(value, &raw, sizeof(DWORD));
+        break;
+    case HWBP_ARG_INT64:
+    case HWBP_ARG_UINT64:
+    case HWBP_ARG_DOUBLE:
+        memcpy(value, &raw, sizeof(DWORD64));
+        break;
+    case HWBP_ARG_POINTER:
+        *(LPVOID *)value = (LPVOID)raw;
+        break;
+    default:
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL bp_sample_string(PHWBP_SAMPLE sample, uint8_t index, LPSTR buffer, SIZE_T size)
+{
+    LPVOID ptr;
+
+    if (!size || !bp_sample_arg(sample, index, HWBP_ARG_POINTER, &ptr))
+        return FALSE;
+
+    // one byte at a time so an unterminated string ending at a page boundary still decodes
+    SIZE_T i = 0;
+    for (; i + 1 < size; i++)
+    {
+        if (!ReadProcessMemory(GetCurrentProcess(), (const BYTE *)ptr + i, &buffer[i], 1, NULL))
+            break;
+        if (!buffer[i])
+            return TRUE;
+    }
+
+    buffer[i] = '\0';
+
+    return i > 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+#include "ring.h"
+#include "pool.h"
+
+// Captures the register state, and optionally a slice of the stack, of every hit of
+// a breakpoint straight into a ring from the exception handler. No user code runs on
+// the hitting thread; a reader drains the ring and decodes arguments at leisure.
+
+typedef enum
+{
+    HWBP_ARG_INT32 = 0,
+    HWBP_ARG_UINT32 = 1,
+    HWBP_ARG_INT64 = 2,
+    HWBP_ARG_UINT64 = 3,
+    HWBP_ARG_POINTER = 4,
+    HWBP_ARG_FLOAT = 5,
+    HWBP_ARG_DOUBLE = 6
+} HWBP_ARG_TYPE;
+
+typedef struct _HWBP_SAMPLE
+{
+    PHWBP bp;
+    DWORD threadId;
+    DWORD eflags;
+    LARGE_INTEGER timestamp;
+    DWORD64 rip, rsp, rbp;
+    DWORD64 rax, rbx, rcx, rdx, rsi, rdi;
+    DWORD64 r8, r9, r10, r11, r12, r13, r14, r15;
+    M128A xmm[4];
+    DWORD stackSize; // bytes of stack captured from rsp upwards
+    BYTE stack[1];
+} HWBP_SAMPLE, *PHWBP_SAMPLE;
+
+typedef struct _HWBP_SAMPLER
+{
+    DWORD stackSize;
+    SIZE_T sampleSize;
+    PHWBP_RING ring;
+    PHWBP_POOL pool; // scratch samples for the handler
+} HWBP_SAMPLER, *PHWBP_SAMPLER;
+
+EXTERN_C_START
+
+// stackSize may be 0 for registers only
+PHWBP_SAMPLER bp_sampler_create(DWORD stackSize, SIZE_T capacity);
+void bp_sampler_destroy(PHWBP_SAMPLER sampler);
+
+// Installs the sampler as bp's callback.
+BOOL bp_sampler_attach(PHWBP_SAMPLER sampler, PHWBP bp);
+
+// sample must point to sampler->sampleSize bytes
+BOOL bp_sampler_read(PHWBP_SAMPLER sampler, PHWBP_SAMPLE sample);
+
+// Decodes argument index of a sample taken at a function entry (Microsoft x64 ABI).
+// Arguments past the fourth come from the captured stack slice.
+BOOL bp_sample_arg(PHWBP_SAMPLE sample, uint8_t index, HWBP_ARG_TYPE type, void *value);
+
+// Reads a NUL terminated string argument. The pointee is read now, not at hit time.
+BOOL bp_sample_string(PHWBP_SAMPLE sample, uint8_t index, LPSTR buffer, SIZE_T size);
+
+EXTERN_C_END
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symbol.h"
+#include <DbgHelp.h>
+
+#pragma comment(lib, "DbgHelp.lib")
+
+#define SYMBOL_NAME_MAX 256
+#define RSDS_SIGNATURE 0x53445352 // "RSDS"
+
+// CodeView record of an image linked with a PDB
+typedef struct _CV_INFO_PDB70
+{
+    DWORD signature;
+    GUID guid;
+    DWORD age;
+    char path[1];
+} CV_INFO_PDB70;
+
+// DbgHelp is single threaded
+static SRWLOCK g_symbols_lock = SRWLOCK_INIT;
+static BOOL g_symbols_loaded = FALSE;
+
+static BOOL symbols_load(void)
+{
+    if (g_symbols_loaded)
+        return TRUE;
+
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS);
+    g_symbols_loaded = SymInitialize(GetCurrentProcess(), NULL, TRUE);
+
+    return g_symbols_loaded;
+}
+
+// Fewest naturally aligned pieces covering [address, address + size).
+static BOOL symbol_split(PHWBP_SYMBOL symbol)
+{
+    ULONG_PTR address = (ULONG_PTR)symbol->address;
+    ULONG_PTR end = address + (ULONG_PTR)symbol->size;
+
+    symbol->count = 0;
+
+    while (address < end)
+    {
+        ULONG_PTR piece = 8;
+        while (address % piece || address + piece > end)
+            piece /= 2;
+
+        if (symbol->count == HWBP_SYMBOL_PIECES)
+            return FALSE;
+
+        HWBP_SYMBOL_PIECE *p = &symbol->pieces[symbol->count++];
+        p->target = (LPVOID)address;
+        p->length = piece == 8 ? EIGHT_BYTE : piece == 4 ? FOUR_BYTE : piece == 2 ? TWO_BYTE : ONE_BYTE;
+
+        address += piece;
+    }
+
+    return symbol->count != 0;
+}
+
+static BOOL symbol_cache_path(HMODULE hModule, char *path, DWORD size)
+{
+    PIMAGE_DOS_HEADER dos = (PIMAGE_DOS_HEADER)hModule;
+    PIMAGE_NT_HEADERS nt = (PIMAGE_NT_HEADERS)((BYTE *)hModule + dos->e_lfanew);
+    IMAGE_DATA_DIRECTORY directory = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG];
+    PIMAGE_DEBUG_DIRECTORY entries = (PIMAGE_DEBUG_DIRECTORY)((BYTE *)hModule + directory.VirtualAddress);
+
+    for (DWORD i = 0; directory.VirtualAddress && i < directory.Size / sizeof(IMAGE_DEBUG_DIRECTORY); i++)
+    {
+        if (entries[i].Type != IMAGE_DEBUG_TYPE_CODEVIEW)
+            continue;
+
+        const CV_INFO_PDB70 *cv = (const CV_INFO_PDB70 *)((BYTE *)hModule + entries[i].AddressOfRawData);
+        if (cv->signature != RSDS_SIGNATURE)
+            continue;
+
+        char temp[MAX_PATH];
+        if (!GetTempPathA(sizeof(temp), temp))
+            return FALSE;
+
+        const GUID *g = &cv->guid;
+        sprintf_s(path, size, "%shwbp-%08lX%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%lX.sym", temp,
+                  g->Data1, g->Data2, g->Data3, g->Data4[0], g->Data4[1], g->Data4[2], g->Data4[3],
+                  g->Data4[4], g->Data4[5], g->Data4[6], g->Data4[7], cv->age);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Lines of "<variable path> <rva> <size>".
+static BOOL symbol_cache_find(const char *path, const char *variable, DWORD64 *rva, ULONG64 *size)
+{
+    FILE *file;
+    char name[SYMBOL_NAME_MAX];
+    BOOL found = FALSE;
+
+    if (fopen_s(&file, path, "r"))
+        return FALSE;
+
+    while (!found && fscanf_s(file, "%255s %llx %llu", name, (unsigned)sizeof(name), rva, size) == 3)
+        found = !strcmp(name, variable);
+
+    fclose(file);
+    return found;
+}
+
+static void symbol_cache_store(const char *path, const char *variable, DWORD64 rva, ULONG64 size)
+{
+    FILE *file;
+
+    if (fopen_s(&file, path, "a"))
+        return;
+
+    fprintf(file, "%s %llx %llu\n", variable, rva, size);
+    fclose(file);
+}
+
+// Follows typedefs to the type itself.
+static ULONG symbol_base_type(DWORD64 base, ULONG type)
+{
+    DWORD tag;
+
+    while (SymGetTypeInfo(GetCurrentProcess(), base, type, TI_GET_SYMTAG, &tag) && tag == SymTagTypedef)
+    {
+        if (!SymGetTypeInfo(GetCurrentProcess(), base, type, TI_GET_TYPEID, &type))
+            break;
+    }
+
+    return type;
+}
+
+static BOOL symbol_member(DWORD64 base, ULONG *type, const char *field, DWORD *offset)
+{
+    HANDLE hProcess = GetCurrentProcess();
+    DWORD count = 0;
+    BOOL found = FALSE;
+
+    *type = symbol_base_type(base, *type);
+
+    if (!SymGetTypeInfo(hProcess, base, *type, TI_GET_CHILDRENCOUNT, &count) || !count)
+        return FALSE;
+
+    TI_FINDCHILDREN_PARAMS *children = (TI_FINDCHILDREN_PARAMS *)calloc(1, sizeof(TI_FINDCHILDREN_PARAMS) + count * sizeof(ULONG));
+    if (!children)
+        return FALSE;
+
+    children->Count = count;
+
+    if (SymGetTypeInfo(hProcess, base, *type, TI_FINDCHILDREN, children))
+    {
+        for (DWORD i = 0; i < count && !found; i++)
+        {
+            WCHAR *name = NULL;
+            char narrow[SYMBOL_NAME_MAX];
+
+            if (!SymGetTypeInfo(hProcess, base, children->ChildId[i], TI_GET_SYMNAME, &name) || !name)
+                continue;
+
+            WideCharToMultiByte(CP_UTF8, 0, name, -1, narrow, sizeof(narrow), NULL, NULL);
+            LocalFree(name);
+
+            // static members and methods have no offset and are skipped here
+            found = !strcmp(narrow, field) &&
+                    SymGetTypeInfo(hProcess, base, children->ChildId[i], TI_GET_OFFSET, offset) &&
+                    SymGetTypeInfo(hProcess, base, children->ChildId[i], TI_GET_TYPEID, type);
+        }
+    }
+
+    free(children);
+    return found;
+}
+
+// SymInitialize only enumerates the modules loaded at the time, one loaded later is
+// unknown until the list is refreshed or the module is loaded explicitly.
+static BOOL symbol_module(HMODULE hModule, PIMAGEHLP_MODULE64 module)
+{
+    HANDLE hProcess = GetCurrentProcess();
+    char file[MAX_PATH];
+
+    if (SymGetModuleInfo64(hProcess, (DWORD64)hModule, module))
+        return TRUE;
+
+    if (SymRefreshModuleList(hProcess) && SymGetModuleInfo64(hProcess, (DWORD64)hModule, module))
+        return TRUE;
+
+    DWORD length = GetModuleFileNameA(hModule, file, sizeof(file));
+    if (!length || length == sizeof(file))
+        return FALSE;
+
+    return SymLoadModuleEx(hProcess, NULL, file, NULL, (DWORD64)hModule, 0, NULL, 0) &&
+           SymGetModuleInfo64(hProcess, (DWORD64)hModule, module);
+}
+
+// variable is looked up in hModule only, SymFromName would otherwise take the first
+// module that has the name while the caller computes the RVA against hModule.
+static BOOL symbol_lookup(HMODULE hModule, const char *variable, DWORD64 *address, ULONG64 *size)
+{
+    char path[SYMBOL_NAME_MAX];
+    IMAGEHLP_MODULE64 module = {0};
+    module.SizeOfStruct = sizeof(module);
+
+    // DbgHelp names a module by its file name without the extension, "app" for app.exe
+    if (!symbols_load() || !symbol_module(hModule, &module))
+        return FALSE;
+
+    // a name too long for the buffer is not looked up truncated
+    if (_snprintf_s(path, sizeof(path), _TRUNCATE, "%s!%s", module.ModuleName, variable) == -1)
+        return FALSE;
+
+    // the variable name ends at the first '.'
+    char *field = strchr(strchr(path, '!'), '.');
+    if (field)
+        *field++ = '\0';
+
+    BYTE buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    PSYMBOL_INFO info = (PSYMBOL_INFO)buffer;
+    info->SizeOfStruct = sizeof(SYMBOL_INFO);
+    info->MaxNameLen = MAX_SYM_NAME;
+
+    if (!SymFromName(GetCurrentProcess(), path, info) || info->ModBase != (DWORD64)hModule)
+        return FALSE;
+
+    DWORD64 base = info->ModBase;
+    ULONG type = info->TypeIndex;
+    *address = info->Address;
+
+    while (field)
+    {
+        char *next = strchr(field, '.');
+        if (next)
+            *next++ = '\0';
+
+        DWORD offset;
+        if (!symbol_member(base, &type, field, &offset))
+            return FALSE;
+
+        *address += offset;
+        field = next;
+    }
+
+    return SymGetTypeInfo(GetCurrentProcess(), base, symbol_base_type(base, type), TI_GET_LENGTH, size) && *size;
+}
+
+BOOL bp_symbol_resolve(LPCSTR name, PHWBP_SYMBOL symbol)
+{
+    char module[MAX_PATH] = {0};
+    char cache[MAX_PATH];
+    const char *variable = name;
+    DWORD64 rva, address;
+    ULONG64 size;
+
+    const char *bang = strchr(name, '!');
+    if (bang)
+    {
+        memcpy(module, name, min((SIZE_T)(bang - name), sizeof(module) - 1));
+        variable = bang + 1;
+    }
+
+    // "app.exe" or the DbgHelp form "app". GetModuleHandle completes a bare name with
+    // ".dll", so an executable is tried first.
+    HMODULE hModule = NULL;
+    if (bang && !strchr(module, '.'))
+    {
+        char exe[MAX_PATH];
+        if (_snprintf_s(exe, sizeof(exe), _TRUNCATE, "%s.exe", module) == -1)
+            return FALSE;
+        hModule = GetModuleHandleA(exe);
+    }
+    if (!hModule)
+        hModule = GetModuleHandleA(bang ? module : NULL);
+    if (!hModule)
+        return FALSE;
+
+    BOOL cached = symbol_cache_path(hModule, cache, sizeof(cache));
+
+    AcquireSRWLockExclusive(&g_symbols_lock);
+
+    BOOL ok = cached && symbol_cache_find(cache, variable, &rva, &size);
+
+    if (ok)
+    {
+        address = (DWORD64)hModule + rva;
+    }
+    else if ((ok = symbol_lookup(hModule, variable, &address, &size)) && cached)
+    {
+        symbol_cache_store(cache, variable, address - (DWORD64)hModule, size);
+    }
+
+    ReleaseSRWLockExclusive(&g_symbols_lock);
+
+    if (!ok)
+        return FALSE;
+
+    symbol->address = (LPVOID)address;
+    symbol->size = size;
+
+    return symbol_split(symbol);
+}
+
+DWORD bp_symbol_create(PHWBP_SYMBOL symbol, DWORD threadId, BP_READ_WRITE read_write, PHWBP *bps)
+{
+    for (DWORD i = 0; i < symbol->count; i++)
+    {
+        bps[i] = bp_create(symbol->pieces[i].target, threadId, read_write, symbol->pieces[i].length);
+        if (bps[i])
+            continue;
+
+        while (i--)
+            bp_destroy(bps[i]);
+
+        return 0;
+    }
+
+    return symbol->count;
+}
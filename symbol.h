@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Global and static variables of this process by name, from the module's PDB.
+//
+//   HWBP_SYMBOL sym;
+//   bp_symbol_resolve("app.exe!g_state.stats.requests", &sym);
+//
+// The module part is optional and defaults to the executable. It may be given as the file
+// name or as DbgHelp does, without the extension ("app!g_state"). Each ".field" steps into
+// a struct, class or union member. The variable is split into the fewest naturally
+// aligned 1/2/4/8 byte pieces, one debug register each.
+//
+// Loading a PDB is slow, so every resolved name is also written to a cache file in the
+// temp directory keyed by the PDB signature (GUID and age, from the CodeView record of
+// the loaded image): a later run of the same build resolves it without DbgHelp.
+
+#define HWBP_SYMBOL_PIECES 4
+
+typedef struct _HWBP_SYMBOL_PIECE
+{
+    LPVOID target;
+    BP_LENGTH length;
+} HWBP_SYMBOL_PIECE;
+
+typedef struct _HWBP_SYMBOL
+{
+    LPVOID address;
+    ULONG64 size;
+    DWORD count;
+    HWBP_SYMBOL_PIECE pieces[HWBP_SYMBOL_PIECES];
+} HWBP_SYMBOL, *PHWBP_SYMBOL;
+
+EXTERN_C_START
+
+// Fails when the name is unknown or the variable needs more than four pieces.
+BOOL bp_symbol_resolve(LPCSTR name, PHWBP_SYMBOL symbol);
+
+// One breakpoint per piece on threadId, not enabled. Returns the number created, 0 on failure.
+DWORD bp_symbol_create(PHWBP_SYMBOL symbol, DWORD threadId, BP_READ_WRITE read_write, PHWBP *bps);
+
+EXTERN_C_END
@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include "tls.h"
+#include <winternl.h>
+
+#define TEB_TLS_POINTER 0x58 // TEB.ThreadLocalStoragePointer on x64
+
+typedef struct _HWBP_THREAD_BASIC_INFORMATION
+{
+    NTSTATUS ExitStatus;
+    PVOID TebBaseAddress;
+    CLIENT_ID ClientId;
+    KAFFINITY AffinityMask;
+    LONG Priority;
+    LONG BasePriority;
+} HWBP_THREAD_BASIC_INFORMATION;
+
+typedef NTSTATUS(NTAPI *PNT_QUERY_INFORMATION_THREAD)(HANDLE thread, ULONG infoClass, PVOID info, ULONG length, PULONG returned);
+
+static PHWBP_TLS_WATCH g_tls_watches = NULL;
+static SRWLOCK g_tls_lock = SRWLOCK_INIT;
+
+// TLS callbacks run for every thread start and exit of the image this is linked into,
+// after the new thread's TLS blocks are allocated.
+static void NTAPI tls_callback(PVOID module, DWORD reason, PVOID reserved);
+
+#ifdef _MSC_VER
+#pragma comment(linker, "/INCLUDE:_tls_used")
+#pragma comment(linker, "/INCLUDE:hwbp_tls_callback")
+#pragma section(".CRT$XLH", read)
+EXTERN_C __declspec(allocate(".CRT$XLH")) const PIMAGE_TLS_CALLBACK hwbp_tls_callback = tls_callback;
+#else
+__attribute__((section(".CRT$XLH"), used)) const PIMAGE_TLS_CALLBACK hwbp_tls_callback = tls_callback;
+#endif
+
+static BOOL tls_index(HMODULE module, DWORD *index)
+{
+    PIMAGE_DOS_HEADER dos = (PIMAGE_DOS_HEADER)module;
+    PIMAGE_NT_HEADERS nt = (PIMAGE_NT_HEADERS)((BYTE *)module + dos->e_lfanew);
+    IMAGE_DATA_DIRECTORY directory = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS];
+
+    if (!directory.VirtualAddress)
+        return FALSE;
+
+    PIMAGE_TLS_DIRECTORY tls = (PIMAGE_TLS_DIRECTORY)((BYTE *)module + directory.VirtualAddress);
+    *index = *(const DWORD *)tls->AddressOfIndex;
+
+    return TRUE;
+}
+
+static PVOID tls_teb(DWORD threadId)
+{
+    static PNT_QUERY_INFORMATION_THREAD query = NULL;
+    HWBP_THREAD_BASIC_INFORMATION info;
+
+    if (threadId == GetCurrentThreadId())
+        return NtCurrentTeb();
+
+    if (!query)
+        query = (PNT_QUERY_INFORMATION_THREAD)GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtQueryInformationThread");
+
+    HANDLE hThread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, threadId);
+    if (!hThread)
+        return NULL;
+
+    // ThreadBasicInformation
+    BOOL ok = query && NT_SUCCESS(query(hThread, 0, &info, sizeof(info), NULL));
+    CloseHandle(hThread);
+
+    return ok ? info.TebBaseAddress : NULL;
+}
+
+static LPVOID tls_block(DWORD tlsIndex, DWORD threadId)
+{
+    BYTE *teb = (BYTE *)tls_teb(threadId);
+    if (!teb)
+        return NULL;
+
+    LPVOID *slots = *(LPVOID **)(teb + TEB_TLS_POINTER);
+
+    return slots ? slots[tlsIndex] : NULL;
+}
+
+BOOL bp_tls_offset(HMODULE module, LPVOID address, DWORD *offset)
+{
+    DWORD index;
+
+    if (!tls_index(module, &index))
+        return FALSE;
+
+    BYTE *block = (BYTE *)tls_block(index, GetCurrentThreadId());
+    if (!block || (BYTE *)address < block)
+        return FALSE;
+
+    *offset = (DWORD)((BYTE *)address - block);
+    return TRUE;
+}
+
+LPVOID bp_tls_address(HMODULE module, DWORD offset, DWORD threadId)
+{
+    DWORD index;
+
+    if (!tls_index(module, &index))
+        return NULL;
+
+    BYTE *block = (BYTE *)tls_block(index, threadId);
+
+    return block ? block + offset : NULL;
+}
+
+// caller holds g_tls_lock
+static PHWBP tls_add(PHWBP_TLS_WATCH watch, DWORD threadId)
+{
+    BYTE *block = (BYTE *)tls_block(watch->tlsIndex, threadId);
+    if (!block)
+        return NULL;
+
+    if (watch->count == watch->capacity)
+    {
+        DWORD capacity = watch->capacity ? watch->capacity * 2 : 64;
+        PHWBP *bps = (PHWBP *)realloc(watch->bps, capacity * sizeof(PHWBP));
+        if (!bps)
+            return NULL;
+
+        watch->bps = bps;
+        watch->capacity = capacity;
+    }
+
+    PHWBP bp = bp_create(block + watch->offset, threadId, watch->read_write, watch->length);
+    if (bp)
+        watch->bps[watch->count++] = bp;
+
+    return bp;
+}
+
+// caller holds g_tls_lock
+static void tls_remove(PHWBP_TLS_WATCH watch, DWORD threadId)
+{
+    for (DWORD i = 0; i < watch->count; i++)
+    {
+        if (watch->bps[i]->threadId != threadId)
+            continue;
+
+        bp_disable(watch->bps[i]);
+        bp_destroy(watch->bps[i]);
+        watch->bps[i] = watch->bps[--watch->count];
+        return;
+    }
+}
+
+static void NTAPI tls_callback(PVOID module, DWORD reason, PVOID reserved)
+{
+    UNREFERENCED_PARAMETER(module);
+    UNREFERENCED_PARAMETER(reserved);
+
+    if (reason != DLL_THREAD_ATTACH && reason != DLL_THREAD_DETACH)
+        return;
+
+    DWORD self = GetCurrentThreadId();
+
+    AcquireSRWLockExclusive(&g_tls_lock);
+
+    for (PHWBP_TLS_WATCH watch = g_tls_watches; watch; watch = watch->next)
+    {
+        if (reason == DLL_THREAD_DETACH)
+        {
+            tls_remove(watch, self);
+            continue;
+        }
+
+        // a thread that was already running when the watch was set up is armed already
+        BOOL known = FALSE;
+        for (DWORD i = 0; i < watch->count && !known; i++)
+            known = watch->bps[i]->threadId == self;
+
+        PHWBP bp = known ? NULL : tls_add(watch, self);
+        if (bp && !bp_enable(bp))
+            tls_remove(watch, self);
+    }
+
+    ReleaseSRWLockExclusive(&g_tls_lock);
+}
+
+// caller holds g_tls_lock
+static void tls_unlink(PHWBP_TLS_WATCH watch)
+{
+    for (PHWBP_TLS_WATCH *link = &g_tls_watches; *link; link = &(*link)->next)
+    {
+        if (*link == watch)
+        {
+            *link = watch->next;
+            break;
+        }
+    }
+}
+
+// The batch is all or nothing, one thread exiting since the snapshot fails it for all.
+// Enables the breakpoints one at a time instead, dropping those of exited threads; a
+// live thread that cannot take its breakpoint still fails the watch.
+// caller holds g_tls_lock
+static BOOL tls_enable_each(PHWBP_TLS_WATCH watch)
+{
+    for (DWORD i = 0; i < watch->count;)
+    {
+        PHWBP bp = watch->bps[i];
+
+        if (bp_enable(bp))
+        {
+            i++;
+            continue;
+        }
+
+        DWORD error = GetLastError();
+        if (!bp_thread_exited(bp->threadId))
+        {
+            SetLastError(error);
+            return FALSE;
+        }
+
+        bp_destroy(bp);
+        watch->bps[i] = watch->bps[--watch->count];
+    }
+
+    return TRUE;
+}
+
+PHWBP_TLS_WATCH bp_tls_watch(HMODULE module, DWORD offset, BP_READ_WRITE read_write, BP_LENGTH length)
+{
+    PHWBP_TLS_WATCH watch = (PHWBP_TLS_WATCH)calloc(1, sizeof(HWBP_TLS_WATCH));
+    if (!watch)
+        return NULL;
+
+    watch->module = module;
+    watch->offset = offset;
+    watch->read_write = read_write;
+    watch->length = length;
+
+    if (!tls_index(module, &watch->tlsIndex))
+    {
+        free(watch);
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&g_tls_lock);
+
+    // linked before the snapshot: a thread starting meanwhile waits for the lock in its
+    // callback and then finds itself armed, or is missing from the snapshot and arms
+    // itself there
+    watch->next = g_tls_watches;
+    g_tls_watches = watch;
+
+    DWORD count;
+    DWORD *threads = bp_list_threads(&count);
+
+    // threads without a block (exiting, or not yet initialized) are left to the callback
+    for (DWORD i = 0; threads && i < count; i++)
+        tls_add(watch, threads[i]);
+
+    // every thread with its own target, written in one pass
+    BOOL ok = threads && (bp_enable_batch(watch->bps, watch->count) || tls_enable_each(watch));
+    DWORD error = GetLastError();
+
+    if (!ok)
+    {
+        tls_unlink(watch);
+
+        for (DWORD i = 0; i < watch->count; i++)
+            bp_destroy(watch->bps[i]);
+    }
+
+    ReleaseSRWLockExclusive(&g_tls_lock);
+
+    free(threads);
+
+    if (!ok)
+    {
+        free(watch->bps);
+        free(watch);
+        SetLastError(error);
+        return NULL;
+    }
+
+    return watch;
+}
+
+void bp_tls_unwatch(PHWBP_TLS_WATCH watch)
+{
+    AcquireSRWLockExclusive(&g_tls_lock);
+
+    tls_unlink(watch);
+
+    bp_disable_batch(watch->bps, watch->count);
+
+    for (DWORD i = 0; i < watch->count; i++)
+        bp_destroy(watch->bps[i]);
+
+    ReleaseSRWLockExclusive(&g_tls_lock);
+
+    free(watch->bps);
+    free(watch);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Watches on a thread-local (__declspec(thread)) variable, which has a different
+// address in every thread. The variable is named by its module and its offset in the
+// module's TLS block; each thread's copy is found through its TEB
+// (ThreadLocalStoragePointer[module's TLS index] + offset), and every thread gets a
+// breakpoint on its own copy. The threads that exist are armed in one batch, threads
+// created later arm themselves from a TLS callback and disarm when they exit.
+
+typedef struct _HWBP_TLS_WATCH
+{
+    HMODULE module;
+    DWORD tlsIndex;
+    DWORD offset;
+    BP_READ_WRITE read_write;
+    BP_LENGTH length;
+    PHWBP *bps; // one per thread, each with that thread's address
+    DWORD count;
+    DWORD capacity;
+    struct _HWBP_TLS_WATCH *next;
+} HWBP_TLS_WATCH, *PHWBP_TLS_WATCH;
+
+EXTERN_C_START
+
+// Offset of a thread-local variable of module, from its address in the calling thread.
+BOOL bp_tls_offset(HMODULE module, LPVOID address, DWORD *offset);
+
+// Address of the variable in threadId's copy of module's TLS block, NULL if it has none.
+LPVOID bp_tls_address(HMODULE module, DWORD offset, DWORD threadId);
+
+PHWBP_TLS_WATCH bp_tls_watch(HMODULE module, DWORD offset, BP_READ_WRITE read_write, BP_LENGTH length);
+void bp_tls_unwatch(PHWBP_TLS_WATCH watch);
+
+EXTERN_C_END
@@ -0,0 +1,126 @@
+// hwbp-bench-counter: the sharded hit counter (counter.h) against one shared atomic.
+//
+//   hwbp-bench-counter [threads] [increments per thread]
+//
+// Every thread adds 1 as fast as it can, first to a single LONG64 with
+// InterlockedIncrement64, then to an HWBP_COUNTER with bp_counter_add. The threads are
+// released together and the slowest one decides the time. Both totals are checked.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Windows.h>
+#include "../counter.h"
+
+#define DEFAULT_THREADS 64
+#define DEFAULT_INCREMENTS 1000000
+#define THREAD_MAX 256
+
+typedef enum
+{
+    SHARED_ATOMIC,
+    SHARDED
+} MODE;
+
+static MODE g_mode;
+static DWORD g_increments;
+static DECLSPEC_ALIGN(64) volatile LONG64 g_shared;
+static PHWBP_COUNTER g_counter;
+static HANDLE g_hStart;
+
+static DWORD WINAPI worker(LPVOID param)
+{
+    UNREFERENCED_PARAMETER(param);
+
+    WaitForSingleObject(g_hStart, INFINITE);
+
+    if (g_mode == SHARED_ATOMIC)
+    {
+        for (DWORD i = 0; i < g_increments; i++)
+            InterlockedIncrement64(&g_shared);
+    }
+    else
+    {
+        for (DWORD i = 0; i < g_increments; i++)
+            bp_counter_add(g_counter, 1);
+    }
+
+    return 0;
+}
+
+// Returns the elapsed milliseconds, 0 on failure.
+static double run(MODE mode, DWORD threads)
+{
+    HANDLE hThreads[THREAD_MAX];
+    LARGE_INTEGER frequency, start, end;
+    DWORD started = 0;
+
+    g_mode = mode;
+    g_hStart = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!g_hStart)
+        return 0;
+
+    for (; started < threads; started++)
+    {
+        hThreads[started] = CreateThread(NULL, 0, worker, NULL, 0, NULL);
+        if (!hThreads[started])
+            break;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    SetEvent(g_hStart);
+
+    // WaitForMultipleObjects takes at most 64 handles at a time
+    for (DWORD i = 0; i < started; i += MAXIMUM_WAIT_OBJECTS)
+        WaitForMultipleObjects(min(started - i, MAXIMUM_WAIT_OBJECTS), hThreads + i, TRUE, INFINITE);
+
+    QueryPerformanceCounter(&end);
+
+    for (DWORD i = 0; i < started; i++)
+        CloseHandle(hThreads[i]);
+    CloseHandle(g_hStart);
+
+    if (started != threads)
+        return 0;
+
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+int main(int argc, char **argv)
+{
+    DWORD threads = argc > 1 ? (DWORD)atoi(argv[1]) : DEFAULT_THREADS;
+    g_increments = argc > 2 ? (DWORD)atoi(argv[2]) : DEFAULT_INCREMENTS;
+
+    if (!threads || threads > THREAD_MAX || !g_increments)
+    {
+        fprintf(stderr, "usage: hwbp-bench-counter [threads 1-%d] [increments per thread]\n", THREAD_MAX);
+        return 1;
+    }
+
+    g_counter = bp_counter_create();
+    if (!g_counter)
+        return 1;
+
+    LONG64 expected = (LONG64)threads * g_increments;
+    double sharedMs = run(SHARED_ATOMIC, threads);
+    double shardedMs = run(SHARDED, threads);
+    LONG64 sharded = bp_counter_read(g_counter);
+
+    bp_counter_destroy(g_counter);
+
+    if (!sharedMs || !shardedMs)
+    {
+        fprintf(stderr, "cannot start %lu threads\n", threads);
+        return 1;
+    }
+
+    printf("%lu threads, %lu increments each\n\n", threads, g_increments);
+    printf("  %-14s %10s %14s %8s\n", "COUNTER", "MS", "INCREMENTS/MS", "TOTAL");
+    printf("  %-14s %10.1f %14.0f %8s\n", "shared atomic", sharedMs, (double)expected / sharedMs,
+           g_shared == expected ? "ok" : "WRONG");
+    printf("  %-14s %10.1f %14.0f %8s\n", "sharded", shardedMs, (double)expected / shardedMs,
+           sharded == expected ? "ok" : "WRONG");
+    printf("\n  sharded is %.1fx the shared atomic\n", sharedMs / shardedMs);
+
+    return g_shared == expected && sharded == expected ? 0 : 1;
+}
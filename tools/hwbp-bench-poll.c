@@ -0,0 +1,99 @@
+// hwbp-bench-poll: words scanned per millisecond by each poll kernel (poll.h).
+//
+//   hwbp-bench-poll [words] [scans]
+//
+// The words are spread one per cache line, as scattered watch targets would be, and
+// about one in a hundred is changed between two scans so the change path is part of
+// the measurement. Kernels the processor does not support are skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Windows.h>
+#include "../poll.h"
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+#define DEFAULT_WORDS 65536
+#define DEFAULT_SCANS 200
+#define STRIDE 8 // words, one per 64 byte line
+#define CHANGE_EVERY 100
+
+static const char *const g_names[] = {"scalar", "sse2", "avx2"};
+
+int main(int argc, char **argv)
+{
+    SIZE_T words = argc > 1 ? (SIZE_T)atoi(argv[1]) : DEFAULT_WORDS;
+    DWORD scans = argc > 2 ? (DWORD)atoi(argv[2]) : DEFAULT_SCANS;
+    LARGE_INTEGER frequency;
+
+    if (!words || !scans)
+    {
+        fprintf(stderr, "usage: hwbp-bench-poll [words] [scans]\n");
+        return 1;
+    }
+
+    volatile DWORD64 *buffer = (volatile DWORD64 *)VirtualAlloc(NULL, words * STRIDE * sizeof(DWORD64),
+                                                               MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    PHWBP_POLL poll = bp_poll_create(0, words / CHANGE_EVERY + 1);
+
+    if (!buffer || !poll)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (SIZE_T i = 0; i < words; i++)
+    {
+        if (!bp_poll_add(poll, (LPVOID)&buffer[i * STRIDE]))
+        {
+            fprintf(stderr, "cannot add word %zu (%lu)\n", i, GetLastError());
+            return 1;
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    printf("%zu words, %lu scans, 1 in %d changed per scan\n\n", words, scans, CHANGE_EVERY);
+    printf("  %-8s %10s %14s %10s\n", "KERNEL", "MS/SCAN", "WORDS/MS", "CHANGES");
+
+    for (int kernel = POLL_SCALAR; kernel <= POLL_AVX2; kernel++)
+    {
+        if (kernel == POLL_AVX2 && !IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE))
+            continue;
+
+        poll->kernel = (HWBP_POLL_KERNEL)kernel;
+        bp_poll_scan(poll); // settle the values the previous kernel left
+
+        HWBP_POLL_CHANGE change;
+        while (bp_poll_read(poll, &change))
+            ;
+
+        LONGLONG ticks = 0;
+        SIZE_T changes = 0;
+
+        for (DWORD s = 0; s < scans; s++)
+        {
+            for (SIZE_T i = s % CHANGE_EVERY; i < words; i += CHANGE_EVERY)
+                buffer[i * STRIDE]++;
+
+            LARGE_INTEGER start, end;
+            QueryPerformanceCounter(&start);
+            changes += bp_poll_scan(poll);
+            QueryPerformanceCounter(&end);
+            ticks += end.QuadPart - start.QuadPart;
+
+            while (bp_poll_read(poll, &change))
+                ;
+        }
+
+        double ms = (double)ticks * 1000.0 / (double)frequency.QuadPart;
+        printf("  %-8s %10.3f %14.0f %10zu\n", g_names[kernel], ms / scans, (double)words * scans / ms, changes);
+    }
+
+    bp_poll_destroy(poll);
+    VirtualFree((LPVOID)buffer, 0, MEM_RELEASE);
+
+    return 0;
+}
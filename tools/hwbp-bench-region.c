@@ -0,0 +1,264 @@
+// hwbp-bench-region: cost of noticing writes to many pages, three ways.
+//
+//   hwbp-bench-region [pages] [rounds]
+//
+// Every round writes one word in each of the pages, then collects what was written:
+//  write-watch: a MEM_WRITE_WATCH region (region.h), collected with bp_region_scan.
+//  page-guard:  the mprotect-style fallback, PAGE_GUARD on every page. The first write
+//               to a page faults into a vectored handler that records it, the guard
+//               then is gone until the whole range is protected again for the next round.
+//  debug-reg:   a DATA_WRITEONLY breakpoint with a counter on the written word of the
+//               first four pages, all the slots there are. Every write to them traps;
+//               moving the slots to the next round's word with bp_retarget is what it
+//               pays instead of a collection.
+//
+// The writes and the collection are timed separately, per write and per round.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Windows.h>
+#include "../hwbp.h"
+#include "../region.h"
+
+#define DEFAULT_PAGES 256
+#define DEFAULT_ROUNDS 1000
+
+typedef struct _RESULT
+{
+    const char *name;
+    DWORD covered; // pages whose writes are noticed
+    double writeNs; // per write
+    double collectUs; // per round
+    LONG64 reported;
+} RESULT;
+
+static LARGE_INTEGER g_frequency;
+
+// page-guard state, one bit per page
+static BYTE *g_guardBase;
+static SIZE_T g_guardSize;
+static DWORD g_pageSize;
+static volatile LONG64 *g_guardDirty;
+static PVOID g_guardHandler;
+
+static double elapsed_ns(LARGE_INTEGER from, LARGE_INTEGER to)
+{
+    return (double)(to.QuadPart - from.QuadPart) * 1e9 / (double)g_frequency.QuadPart;
+}
+
+static void write_pages(volatile DWORD64 *base, DWORD pages, DWORD round)
+{
+    SIZE_T words = g_pageSize / sizeof(DWORD64);
+
+    for (DWORD p = 0; p < pages; p++)
+        base[p * words + round % 8]++;
+}
+
+static RESULT run_write_watch(DWORD pages, DWORD rounds)
+{
+    RESULT result = {"write-watch", pages, 0, 0, 0};
+    SIZE_T size = (SIZE_T)pages * g_pageSize;
+    LPVOID base = bp_region_alloc(size);
+    PHWBP_REGION region = base ? bp_region_watch(base, size, 0, NULL, NULL) : NULL;
+    double writeNs = 0, collectNs = 0;
+
+    if (!region)
+    {
+        fprintf(stderr, "write-watch: cannot watch the region (%lu)\n", GetLastError());
+        if (base)
+            bp_region_free(base);
+        return result;
+    }
+
+    for (DWORD r = 0; r < rounds; r++)
+    {
+        LARGE_INTEGER t0, t1, t2;
+        ULONG_PTR count = 0;
+
+        QueryPerformanceCounter(&t0);
+        write_pages((volatile DWORD64 *)base, pages, r);
+        QueryPerformanceCounter(&t1);
+        bp_region_scan(region, &count);
+        QueryPerformanceCounter(&t2);
+
+        writeNs += elapsed_ns(t0, t1);
+        collectNs += elapsed_ns(t1, t2);
+        result.reported += (LONG64)count;
+    }
+
+    bp_region_unwatch(region);
+    bp_region_free(base);
+
+    result.writeNs = writeNs / ((double)pages * rounds);
+    result.collectUs = collectNs / 1000 / rounds;
+    return result;
+}
+
+static LONG CALLBACK guard_handler(PEXCEPTION_POINTERS info)
+{
+    if (info->ExceptionRecord->ExceptionCode != STATUS_GUARD_PAGE_VIOLATION)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    BYTE *address = (BYTE *)info->ExceptionRecord->ExceptionInformation[1];
+    if (address < g_guardBase || address >= g_guardBase + g_guardSize)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    // the system has already dropped the guard, the write succeeds when retried
+    SIZE_T page = (SIZE_T)(address - g_guardBase) / g_pageSize;
+    InterlockedOr64(&g_guardDirty[page / 64], 1ll << (page % 64));
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+static RESULT run_page_guard(DWORD pages, DWORD rounds)
+{
+    RESULT result = {"page-guard", pages, 0, 0, 0};
+    DWORD old;
+    double writeNs = 0, collectNs = 0;
+
+    g_guardSize = (SIZE_T)pages * g_pageSize;
+    g_guardBase = (BYTE *)VirtualAlloc(NULL, g_guardSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    g_guardDirty = (volatile LONG64 *)calloc((pages + 63) / 64, sizeof(LONG64));
+    g_guardHandler = AddVectoredExceptionHandler(1, guard_handler);
+
+    if (!g_guardBase || !g_guardDirty || !g_guardHandler ||
+        !VirtualProtect(g_guardBase, g_guardSize, PAGE_READWRITE | PAGE_GUARD, &old))
+    {
+        fprintf(stderr, "page-guard: cannot set up (%lu)\n", GetLastError());
+        rounds = 0;
+    }
+
+    for (DWORD r = 0; r < rounds; r++)
+    {
+        LARGE_INTEGER t0, t1, t2;
+
+        QueryPerformanceCounter(&t0);
+        write_pages((volatile DWORD64 *)g_guardBase, pages, r);
+        QueryPerformanceCounter(&t1);
+
+        // collect and reset the dirty bits, then guard the range again
+        for (DWORD i = 0; i < (pages + 63) / 64; i++)
+        {
+            LONG64 bits = InterlockedExchange64(&g_guardDirty[i], 0);
+            for (; bits; bits &= bits - 1)
+                result.reported++;
+        }
+        VirtualProtect(g_guardBase, g_guardSize, PAGE_READWRITE | PAGE_GUARD, &old);
+
+        QueryPerformanceCounter(&t2);
+
+        writeNs += elapsed_ns(t0, t1);
+        collectNs += elapsed_ns(t1, t2);
+    }
+
+    if (g_guardHandler)
+        RemoveVectoredExceptionHandler(g_guardHandler);
+    if (g_guardBase)
+        VirtualFree(g_guardBase, 0, MEM_RELEASE);
+    free((void *)g_guardDirty);
+
+    if (rounds)
+    {
+        result.writeNs = writeNs / ((double)pages * rounds);
+        result.collectUs = collectNs / 1000 / rounds;
+    }
+    return result;
+}
+
+static RESULT run_debug_registers(DWORD pages, DWORD rounds)
+{
+    RESULT result = {"debug-reg", min(pages, 4), 0, 0, 0};
+    SIZE_T words = g_pageSize / sizeof(DWORD64);
+    volatile DWORD64 *base = (volatile DWORD64 *)VirtualAlloc(NULL, (SIZE_T)pages * g_pageSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    PHWBP_COUNTER counter = bp_counter_create();
+    PHWBP bps[4] = {0};
+    double writeNs = 0;
+
+    if (!base || !counter)
+    {
+        fprintf(stderr, "debug-reg: out of memory\n");
+        rounds = 0;
+    }
+
+    for (DWORD i = 0; rounds && i < result.covered; i++)
+    {
+        bps[i] = bp_create((LPVOID)&base[i * words], GetCurrentThreadId(), DATA_WRITEONLY, EIGHT_BYTE);
+        if (!bps[i] || !bp_set_counter(bps[i], counter) || !bp_enable(bps[i]))
+        {
+            fprintf(stderr, "debug-reg: cannot arm slot %lu (%lu)\n", i, GetLastError());
+            rounds = 0;
+        }
+    }
+
+    double collectNs = 0;
+
+    for (DWORD r = 0; r < rounds; r++)
+    {
+        LARGE_INTEGER t0, t1, t2;
+
+        QueryPerformanceCounter(&t0);
+        for (DWORD i = 0; i < result.covered; i++)
+            bp_retarget(bps[i], (LPVOID)&base[i * words + r % 8], EIGHT_BYTE);
+        QueryPerformanceCounter(&t1);
+        write_pages(base, pages, r);
+        QueryPerformanceCounter(&t2);
+
+        collectNs += elapsed_ns(t0, t1);
+        writeNs += elapsed_ns(t1, t2);
+    }
+
+    for (DWORD i = 0; i < 4; i++)
+    {
+        if (bps[i])
+            bp_destroy(bps[i]);
+    }
+
+    if (counter)
+    {
+        result.reported = bp_counter_read(counter);
+        bp_counter_destroy(counter);
+    }
+    if (base)
+        VirtualFree((LPVOID)base, 0, MEM_RELEASE);
+
+    if (rounds)
+    {
+        result.writeNs = writeNs / ((double)pages * rounds);
+        result.collectUs = collectNs / 1000 / rounds;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    DWORD pages = argc > 1 ? (DWORD)atoi(argv[1]) : DEFAULT_PAGES;
+    DWORD rounds = argc > 2 ? (DWORD)atoi(argv[2]) : DEFAULT_ROUNDS;
+    SYSTEM_INFO info;
+
+    if (!pages || !rounds)
+    {
+        fprintf(stderr, "usage: hwbp-bench-region [pages] [rounds]\n");
+        return 1;
+    }
+
+    GetSystemInfo(&info);
+    g_pageSize = info.dwPageSize;
+    QueryPerformanceFrequency(&g_frequency);
+
+    RESULT results[3];
+    results[0] = run_write_watch(pages, rounds);
+    results[1] = run_page_guard(pages, rounds);
+    results[2] = run_debug_registers(pages, rounds);
+
+    printf("%lu pages, %lu rounds, one write per page per round\n\n", pages, rounds);
+    printf("  %-12s %8s %12s %16s %12s\n", "MECHANISM", "COVERED", "NS/WRITE", "COLLECT US/ROUND", "REPORTED");
+
+    for (DWORD i = 0; i < 3; i++)
+    {
+        printf("  %-12s %8lu %12.1f %16.2f %12lld\n", results[i].name, results[i].covered, results[i].writeNs,
+               results[i].collectUs, results[i].reported);
+    }
+
+    return 0;
+}
@@ -0,0 +1,360 @@
+// hwbp-preload.dll: arms watches on an unmodified program from its environment.
+//
+//   HWBP_WATCH=g_state.count:w:4;app.exe!g_config:rw    watches, ';' separated
+//   HWBP_WATCH_FILE=watches.txt                          or one per line in a file
+//   HWBP_WATCH_LOG=hits.log                              default hwbp-<pid>.log
+//
+// A watch is <location>:<r|w|rw|x>[:<length>], location being a variable for
+// bp_symbol_resolve (module!var.field) or an address (0x...). A variable larger than
+// 8 bytes takes several of the four debug registers.
+//
+// hwbp-run.exe loads the DLL into a suspended process. DllMain only reads the
+// configuration, the watches are resolved and armed on a thread of their own since
+// DbgHelp must not run under the loader lock; hwbp-run waits for it before resuming the
+// program. Threads created later arm themselves in DLL_THREAD_ATTACH. Hits go through
+// an event ring to a thread that appends them to the log, the first line of which is
+// the time setup took.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Windows.h>
+#include "../hwbp.h"
+#include "../ring.h"
+#include "../symbol.h"
+
+#define WATCH_MAX 4
+#define SPEC_MAX 1024
+#define RING_CAPACITY 16384
+
+typedef struct _PRELOAD_WATCH
+{
+    char spec[128];
+    LPVOID target;
+    BP_READ_WRITE read_write;
+    BP_LENGTH length;
+} PRELOAD_WATCH;
+
+typedef struct _PRELOAD_HIT
+{
+    LARGE_INTEGER timestamp;
+    DWORD64 ip;
+    DWORD threadId;
+    DWORD watch;
+} PRELOAD_HIT;
+
+static PRELOAD_WATCH g_watches[WATCH_MAX];
+static DWORD g_watchCount;
+static char g_specs[SPEC_MAX];
+static char g_logPath[MAX_PATH];
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static BOOL g_armed;
+static PHWBP *g_existing; // breakpoints of the threads found at setup
+static DWORD *g_existingThreads;
+static DWORD g_existingCount;
+
+static __declspec(thread) PHWBP t_bps[WATCH_MAX];
+
+static PHWBP_RING g_hits;
+static FILE *g_log;
+static HANDLE g_hStop;
+
+static void on_hit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    PRELOAD_HIT hit;
+
+    UNREFERENCED_PARAMETER(bp);
+
+    QueryPerformanceCounter(&hit.timestamp);
+    hit.ip = ctx->Rip;
+    hit.threadId = GetCurrentThreadId();
+    hit.watch = (DWORD)(ULONG_PTR)param;
+
+    bp_ring_push(g_hits, &hit);
+}
+
+static void drain(void)
+{
+    PRELOAD_HIT hit;
+
+    while (bp_ring_pop(g_hits, &hit))
+        fprintf(g_log, "%lld %lu %lu 0x%llx\n", hit.timestamp.QuadPart, hit.threadId, hit.watch, hit.ip);
+
+    fflush(g_log);
+}
+
+static DWORD WINAPI logger(LPVOID param)
+{
+    UNREFERENCED_PARAMETER(param);
+
+    while (WaitForSingleObject(g_hStop, 100) == WAIT_TIMEOUT)
+        drain();
+
+    return 0;
+}
+
+static BP_LENGTH to_length(ULONG_PTR bytes)
+{
+    return bytes == 8 ? EIGHT_BYTE : bytes == 4 ? FOUR_BYTE : bytes == 2 ? TWO_BYTE : ONE_BYTE;
+}
+
+// location:access[:length], parsed from the right since C++ names contain colons
+static BOOL add_watch(char *spec)
+{
+    BP_READ_WRITE read_write;
+    ULONG_PTR length = 0;
+
+    char *colon = strrchr(spec, ':');
+    if (!colon)
+        return FALSE;
+
+    if (colon[1] >= '0' && colon[1] <= '9')
+    {
+        length = strtoul(colon + 1, NULL, 10);
+        *colon = '\0';
+        if (!(colon = strrchr(spec, ':')))
+            return FALSE;
+    }
+
+    const char *access = colon + 1;
+    *colon = '\0';
+
+    if (!strcmp(access, "x"))
+        read_write = INSTRUCTION_EXECUTION;
+    else if (!strcmp(access, "w"))
+        read_write = DATA_WRITEONLY;
+    else if (!strcmp(access, "r") || !strcmp(access, "rw"))
+        read_write = DATA_READWRITE;
+    else
+        return FALSE;
+
+    HWBP_SYMBOL symbol;
+
+    if (!_strnicmp(spec, "0x", 2))
+    {
+        symbol.count = 1;
+        symbol.pieces[0].target = (LPVOID)_strtoui64(spec, NULL, 16);
+        symbol.pieces[0].length = to_length(length ? length : 4);
+    }
+    else if (!bp_symbol_resolve(spec, &symbol))
+    {
+        return FALSE;
+    }
+
+    if (read_write == INSTRUCTION_EXECUTION)
+    {
+        symbol.count = 1;
+        symbol.pieces[0].length = ONE_BYTE;
+    }
+    else if (length && symbol.count == 1)
+    {
+        symbol.pieces[0].length = to_length(length); // narrower than the variable
+    }
+
+    if (g_watchCount + symbol.count > WATCH_MAX)
+        return FALSE;
+
+    for (DWORD i = 0; i < symbol.count; i++)
+    {
+        PRELOAD_WATCH *watch = &g_watches[g_watchCount++];
+        strncpy_s(watch->spec, sizeof(watch->spec), spec, _TRUNCATE);
+        watch->target = symbol.pieces[i].target;
+        watch->read_write = read_write;
+        watch->length = symbol.pieces[i].length;
+    }
+
+    return TRUE;
+}
+
+static PHWBP create_bp(DWORD i, DWORD threadId)
+{
+    PHWBP bp = bp_create(g_watches[i].target, threadId, g_watches[i].read_write, g_watches[i].length);
+
+    if (bp && !bp_set_callback(bp, on_hit, (LPVOID)(ULONG_PTR)i))
+    {
+        bp_destroy(bp);
+        bp = NULL;
+    }
+
+    return bp;
+}
+
+// caller holds g_lock
+static void arm_existing(void)
+{
+    DWORD count;
+    DWORD *threads = bp_list_threads(&count);
+
+    g_existing = threads ? (PHWBP *)calloc((SIZE_T)count * g_watchCount, sizeof(PHWBP)) : NULL;
+    if (!g_existing)
+    {
+        free(threads);
+        return;
+    }
+
+    DWORD n = 0;
+    for (DWORD t = 0; t < count; t++)
+    {
+        for (DWORD i = 0; i < g_watchCount; i++)
+        {
+            PHWBP bp = create_bp(i, threads[t]);
+            if (bp)
+                g_existing[n++] = bp;
+        }
+    }
+
+    // a thread that exited since the snapshot fails its own part only
+    if (!bp_enable_batch(g_existing, n))
+    {
+        for (DWORD i = 0; i < n; i++)
+            bp_enable(g_existing[i]);
+    }
+
+    g_existingThreads = threads;
+    g_existingCount = count;
+}
+
+static void arm_self(void)
+{
+    DWORD self = GetCurrentThreadId();
+
+    AcquireSRWLockExclusive(&g_lock);
+
+    BOOL known = FALSE;
+    for (DWORD t = 0; t < g_existingCount && !known; t++)
+        known = g_existingThreads[t] == self;
+
+    for (DWORD i = 0; g_armed && !known && i < g_watchCount; i++)
+    {
+        t_bps[i] = create_bp(i, self);
+        if (t_bps[i] && !bp_enable(t_bps[i]))
+        {
+            bp_destroy(t_bps[i]);
+            t_bps[i] = NULL;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+static void disarm_self(void)
+{
+    for (DWORD i = 0; i < WATCH_MAX; i++)
+    {
+        if (t_bps[i])
+        {
+            bp_disable(t_bps[i]);
+            bp_destroy(t_bps[i]);
+            t_bps[i] = NULL;
+        }
+    }
+}
+
+static DWORD WINAPI setup(LPVOID param)
+{
+    LARGE_INTEGER start, end, frequency;
+    char event[64];
+
+    UNREFERENCED_PARAMETER(param);
+
+    QueryPerformanceCounter(&start);
+
+    char *context = NULL;
+    for (char *spec = strtok_s(g_specs, ";\r\n", &context); spec; spec = strtok_s(NULL, ";\r\n", &context))
+    {
+        if (*spec && !add_watch(spec))
+            fprintf(g_log, "# cannot resolve '%s'\n", spec);
+    }
+
+    AcquireSRWLockExclusive(&g_lock);
+    g_armed = TRUE;
+    arm_existing();
+    ReleaseSRWLockExclusive(&g_lock);
+
+    QueryPerformanceCounter(&end);
+    QueryPerformanceFrequency(&frequency);
+
+    fprintf(g_log, "# %lu watches armed in %.3f ms\n", g_watchCount,
+            (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart);
+    for (DWORD i = 0; i < g_watchCount; i++)
+        fprintf(g_log, "# watch %lu %p %s\n", i, g_watches[i].target, g_watches[i].spec);
+    fprintf(g_log, "# qpc thread watch ip\n");
+    fflush(g_log);
+
+    // hwbp-run waits for this before it resumes the program
+    sprintf_s(event, sizeof(event), "Local\\hwbp-preload-%lu", GetCurrentProcessId());
+    HANDLE hReady = OpenEventA(EVENT_MODIFY_STATE, FALSE, event);
+    if (hReady)
+    {
+        SetEvent(hReady);
+        CloseHandle(hReady);
+    }
+
+    return 0;
+}
+
+static BOOL read_config(void)
+{
+    char file[MAX_PATH];
+
+    if (!GetEnvironmentVariableA("HWBP_WATCH", g_specs, sizeof(g_specs)) &&
+        GetEnvironmentVariableA("HWBP_WATCH_FILE", file, sizeof(file)))
+    {
+        FILE *f;
+        if (!fopen_s(&f, file, "r"))
+        {
+            g_specs[fread(g_specs, 1, sizeof(g_specs) - 1, f)] = '\0';
+            fclose(f);
+        }
+    }
+
+    if (!GetEnvironmentVariableA("HWBP_WATCH_LOG", g_logPath, sizeof(g_logPath)))
+        sprintf_s(g_logPath, sizeof(g_logPath), "hwbp-%lu.log", GetCurrentProcessId());
+
+    return g_specs[0] != '\0';
+}
+
+BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID reserved)
+{
+    UNREFERENCED_PARAMETER(hInstance);
+    UNREFERENCED_PARAMETER(reserved);
+
+    switch (reason)
+    {
+    case DLL_PROCESS_ATTACH:
+        if (!read_config() || fopen_s(&g_log, g_logPath, "w"))
+            return TRUE; // nothing to do, stay loaded and idle
+
+        g_hits = bp_ring_create(sizeof(PRELOAD_HIT), RING_CAPACITY);
+        g_hStop = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!g_hits || !g_hStop)
+            return TRUE;
+
+        // both start once the loader lock is released
+        CloseHandle(CreateThread(NULL, 0, setup, NULL, 0, NULL));
+        CloseHandle(CreateThread(NULL, 0, logger, NULL, 0, NULL));
+        break;
+
+    case DLL_THREAD_ATTACH:
+        if (g_hits)
+            arm_self();
+        break;
+
+    case DLL_THREAD_DETACH:
+        disarm_self();
+        break;
+
+    case DLL_PROCESS_DETACH:
+        // the other threads are gone or about to be, only flush what was recorded
+        if (g_log)
+        {
+            if (g_hits)
+                drain();
+            fclose(g_log);
+        }
+        break;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,117 @@
+// hwbp-run: starts a program with hwbp-preload.dll loaded before its first instruction.
+//
+//   set HWBP_WATCH=g_state.count:w:4
+//   hwbp-run <program> [arguments]
+//
+// The program is created suspended, the DLL is loaded into it by a remote LoadLibraryW,
+// and the program is resumed once the DLL signals that its watches are armed.
+
+#include <stdio.h>
+#include <string.h>
+#include <Windows.h>
+
+#define READY_TIMEOUT 10000
+
+// The injected LoadLibraryW address and hwbp-preload.dll are both of this build, a
+// program of the other bitness (a 32-bit one under WOW64) cannot load them.
+static BOOL same_bitness(HANDLE hProcess)
+{
+    USHORT machine, self, native;
+
+    if (IsWow64Process2(hProcess, &machine, &native) && IsWow64Process2(GetCurrentProcess(), &self, &native))
+        return machine == self;
+
+    BOOL wow64 = FALSE, selfWow64 = FALSE;
+    IsWow64Process(hProcess, &wow64);
+    IsWow64Process(GetCurrentProcess(), &selfWow64);
+
+    return wow64 == selfWow64;
+}
+
+int main(void)
+{
+    WCHAR dll[MAX_PATH];
+    char event[64];
+
+    // everything after our own name is the program's command line
+    LPWSTR commandLine = GetCommandLineW();
+    BOOL quoted = FALSE;
+    while (*commandLine && (quoted || *commandLine != L' '))
+        quoted ^= *commandLine++ == L'"';
+    while (*commandLine == L' ')
+        commandLine++;
+
+    if (!*commandLine)
+    {
+        fprintf(stderr, "usage: hwbp-run <program> [arguments]\n");
+        return 1;
+    }
+
+    // the DLL sits next to this executable
+    DWORD length = GetModuleFileNameW(NULL, dll, MAX_PATH);
+    while (length && dll[length - 1] != L'\\')
+        length--;
+    wcscpy_s(dll + length, MAX_PATH - length, L"hwbp-preload.dll");
+
+    STARTUPINFOW si = {0};
+    PROCESS_INFORMATION pi = {0};
+    si.cb = sizeof(si);
+
+    if (!CreateProcessW(NULL, commandLine, NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &si, &pi))
+    {
+        fprintf(stderr, "cannot start program (%lu)\n", GetLastError());
+        return 1;
+    }
+
+    if (!same_bitness(pi.hProcess))
+    {
+        fprintf(stderr, "the program is %s-bit, use the %s-bit build of hwbp-run and hwbp-preload.dll\n",
+                sizeof(void *) == 8 ? "32" : "64", sizeof(void *) == 8 ? "32" : "64");
+        TerminateProcess(pi.hProcess, 1);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+        return 1;
+    }
+
+    sprintf_s(event, sizeof(event), "Local\\hwbp-preload-%lu", pi.dwProcessId);
+    HANDLE hReady = CreateEventA(NULL, TRUE, FALSE, event);
+
+    SIZE_T size = (wcslen(dll) + 1) * sizeof(WCHAR);
+    LPVOID remote = VirtualAllocEx(pi.hProcess, NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    BOOL ok = remote && WriteProcessMemory(pi.hProcess, remote, dll, size, NULL);
+
+    // kernel32 is mapped at the same address in every process of a boot session
+    LPTHREAD_START_ROUTINE loadLibrary =
+        (LPTHREAD_START_ROUTINE)GetProcAddress(GetModuleHandleA("kernel32.dll"), "LoadLibraryW");
+    HANDLE hLoader = ok ? CreateRemoteThread(pi.hProcess, NULL, 0, loadLibrary, remote, 0, NULL) : NULL;
+
+    if (hLoader)
+    {
+        WaitForSingleObject(hLoader, INFINITE);
+        CloseHandle(hLoader);
+
+        // not signaled when the DLL found no configuration, run the program anyway
+        if (hReady)
+            WaitForSingleObject(hReady, READY_TIMEOUT);
+    }
+    else
+    {
+        fprintf(stderr, "cannot load hwbp-preload.dll into the program (%lu)\n", GetLastError());
+    }
+
+    if (remote)
+        VirtualFreeEx(pi.hProcess, remote, 0, MEM_RELEASE);
+
+    ResumeThread(pi.hThread);
+    WaitForSingleObject(pi.hProcess, INFINITE);
+
+    DWORD exitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+
+    if (hReady)
+        CloseHandle(hReady);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+
+    return (int)exitCode;
+}
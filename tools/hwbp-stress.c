@@ -0,0 +1,203 @@
+// hwbp-stress: churns breakpoints from several threads at once and verifies the debug
+// registers after every step.
+//
+//   hwbp-stress [seconds] [drivers] [victims]
+//
+// Victim threads keep writing to a set of watched variables. Each driver thread owns its
+// own breakpoints on those threads and applies random create/enable/disable/destroy
+// operations to them, following every operation with bp_check_thread on the victim it
+// touched. The first mismatch stops the run with exit code 1. Operations per second are
+// printed once a second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Windows.h>
+#include "../hwbp.h"
+
+#define DRIVER_MAX 16
+#define VICTIM_MAX 16
+#define BP_PER_DRIVER 8
+#define TARGET_COUNT 64
+
+typedef struct _DRIVER
+{
+    DWORD index;
+    DWORD seed;
+    PHWBP bps[BP_PER_DRIVER];
+    HANDLE hThread;
+} DRIVER;
+
+static volatile LONG64 g_targets[TARGET_COUNT];
+static DWORD g_victims[VICTIM_MAX];
+static DWORD g_victimCount;
+static DRIVER g_drivers[DRIVER_MAX];
+static volatile LONG g_stop;
+static volatile LONG64 g_ops;
+static volatile LONG64 g_hits;
+static volatile LONG g_failed;
+
+static DWORD next_random(DWORD *seed)
+{
+    // xorshift32, one private state per driver
+    DWORD x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static void on_hit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    UNREFERENCED_PARAMETER(bp);
+    UNREFERENCED_PARAMETER(ctx);
+    UNREFERENCED_PARAMETER(param);
+    InterlockedIncrement64(&g_hits);
+}
+
+static DWORD WINAPI victim_main(LPVOID param)
+{
+    UNREFERENCED_PARAMETER(param);
+
+    for (DWORD i = 0; !g_stop; i++)
+        g_targets[i % TARGET_COUNT]++;
+
+    return 0;
+}
+
+static BOOL check(DRIVER *driver, DWORD threadId, const char *op)
+{
+    if (bp_check_thread(threadId))
+        return TRUE;
+
+    // an exited victim cannot be read, only a real mismatch is a failure
+    if (GetLastError() != ERROR_INVALID_DATA)
+        return TRUE;
+
+    if (!InterlockedExchange(&g_failed, TRUE))
+        fprintf(stderr, "driver %lu: debug registers of thread %lu inconsistent after %s\n", driver->index, threadId, op);
+
+    InterlockedExchange(&g_stop, TRUE);
+    return FALSE;
+}
+
+static DWORD WINAPI driver_main(LPVOID param)
+{
+    DRIVER *driver = (DRIVER *)param;
+
+    while (!g_stop)
+    {
+        DWORD r = next_random(&driver->seed);
+        PHWBP *slot = &driver->bps[r % BP_PER_DRIVER];
+        DWORD threadId;
+        const char *op;
+
+        if (!*slot)
+        {
+            threadId = g_victims[(r >> 8) % g_victimCount];
+            BP_LENGTH length = (r >> 16) & 1 ? EIGHT_BYTE : FOUR_BYTE;
+            BP_READ_WRITE read_write = (r >> 17) & 1 ? DATA_READWRITE : DATA_WRITEONLY;
+
+            *slot = bp_create((LPVOID)&g_targets[(r >> 20) % TARGET_COUNT], threadId, read_write, length);
+            if (!*slot)
+                continue;
+
+            bp_set_callback(*slot, on_hit, NULL);
+            op = "create";
+        }
+        else
+        {
+            threadId = (*slot)->threadId;
+
+            switch ((r >> 8) % 4)
+            {
+            case 0:
+                bp_destroy(*slot);
+                *slot = NULL;
+                op = "destroy";
+                break;
+            case 1:
+            case 2:
+                // all four slots of a victim may be taken by other drivers, that is not an error
+                bp_enable(*slot);
+                op = "enable";
+                break;
+            default:
+                bp_disable(*slot);
+                op = "disable";
+                break;
+            }
+        }
+
+        InterlockedIncrement64(&g_ops);
+
+        if (!check(driver, threadId, op))
+            break;
+    }
+
+    for (DWORD i = 0; i < BP_PER_DRIVER; i++)
+    {
+        if (driver->bps[i])
+            bp_destroy(driver->bps[i]);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    DWORD seconds = argc > 1 ? (DWORD)atoi(argv[1]) : 10;
+    DWORD drivers = argc > 2 ? (DWORD)atoi(argv[2]) : 4;
+    DWORD victims = argc > 3 ? (DWORD)atoi(argv[3]) : 4;
+    HANDLE hVictims[VICTIM_MAX];
+
+    if (!drivers || drivers > DRIVER_MAX || !victims || victims > VICTIM_MAX)
+    {
+        fprintf(stderr, "usage: hwbp-stress [seconds] [drivers 1-%d] [victims 1-%d]\n", DRIVER_MAX, VICTIM_MAX);
+        return 1;
+    }
+
+    for (DWORD i = 0; i < victims; i++)
+    {
+        hVictims[i] = CreateThread(NULL, 0, victim_main, NULL, 0, &g_victims[i]);
+        if (!hVictims[i])
+        {
+            fprintf(stderr, "cannot start victim thread (%lu)\n", GetLastError());
+            return 1;
+        }
+        g_victimCount++;
+    }
+
+    for (DWORD i = 0; i < drivers; i++)
+    {
+        g_drivers[i].index = i;
+        g_drivers[i].seed = GetTickCount() * 2654435761u + i * 40503u + 1;
+        g_drivers[i].hThread = CreateThread(NULL, 0, driver_main, &g_drivers[i], 0, NULL);
+    }
+
+    LONG64 lastOps = 0;
+    for (DWORD s = 0; s < seconds && !g_stop; s++)
+    {
+        Sleep(1000);
+        LONG64 ops = g_ops;
+        printf("%6lu s  %10lld ops/s  %12lld ops  %12lld hits\n", s + 1, ops - lastOps, ops, g_hits);
+        lastOps = ops;
+    }
+
+    InterlockedExchange(&g_stop, TRUE);
+
+    for (DWORD i = 0; i < drivers; i++)
+    {
+        if (g_drivers[i].hThread)
+        {
+            WaitForSingleObject(g_drivers[i].hThread, INFINITE);
+            CloseHandle(g_drivers[i].hThread);
+        }
+    }
+
+    WaitForMultipleObjects(g_victimCount, hVictims, TRUE, INFINITE);
+    for (DWORD i = 0; i < g_victimCount; i++)
+        CloseHandle(hVictims[i]);
+
+    printf("%s: %lld operations, %lld hits\n", g_failed ? "FAILED" : "passed", g_ops, g_hits);
+    return g_failed ? 1 : 0;
+}
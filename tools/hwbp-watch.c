@@ -0,0 +1,575 @@
+// hwbp-watch: attaches to a process as a debugger, puts up to four hardware watches on
+// all of its threads and shows hits per second by instruction pointer and thread.
+//
+//   hwbp-watch <pid> <location>:<r|w|rw|x>[:<length>] ...
+//
+// location is an address (0x...), a symbol or module!symbol, optionally +offset.
+// r is treated as rw, x86 has no read-only watch. length is 1, 2, 4 or 8 (default 4,
+// always 1 for x).
+//
+// 32-bit (WOW64) targets are watched through their WOW64 context, where addresses above
+// 4 GB and 8 byte lengths do not exist.
+//
+// The debug loop only records each hit in an event ring and continues the target; the
+// display drains the ring once a second on its own thread, so a slow console never
+// holds up the target. Hits are dropped, and counted, when the ring is full.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Windows.h>
+#include <DbgHelp.h>
+#include "../hwbp.h"
+#include "../ring.h"
+
+#pragma comment(lib, "DbgHelp.lib")
+
+#define WATCH_MAX 4
+#define THREAD_MAX 4096
+#define STAT_MAX 4096 // distinct (ip, thread, watch) rows
+#define ROWS 25
+#define RING_CAPACITY 65536
+#define EFLAGS_RF 0x10000
+
+// what a 64-bit debugger sees for the debug exceptions of a WOW64 thread, from ntstatus.h
+#ifndef STATUS_WX86_SINGLE_STEP
+#define STATUS_WX86_SINGLE_STEP 0x4000001E
+#define STATUS_WX86_BREAKPOINT 0x4000001F
+#endif
+
+typedef struct _WATCH
+{
+    char spec[128];
+    DWORD64 address;
+    BP_READ_WRITE read_write;
+    BP_LENGTH length;
+    HWBP bp; // only encodes the slot, the target's threads are not managed by the library
+} WATCH;
+
+typedef struct _HIT
+{
+    DWORD64 ip;
+    DWORD threadId;
+    DWORD watch;
+} HIT;
+
+typedef struct _STAT
+{
+    DWORD64 ip;
+    DWORD threadId;
+    DWORD watch;
+    LONG64 total;
+    LONG64 window;
+} STAT;
+
+static WATCH g_watches[WATCH_MAX];
+static DWORD g_watchCount;
+static HANDLE g_hProcess;
+static BOOL g_wow64;
+static PHWBP_RING g_hits;
+static volatile LONG g_stop;
+
+static struct
+{
+    DWORD threadId;
+    HANDLE hThread;
+} g_threads[THREAD_MAX];
+
+static STAT g_stats[STAT_MAX];
+static DWORD g_statCount;
+
+static BOOL WINAPI on_ctrl(DWORD type)
+{
+    UNREFERENCED_PARAMETER(type);
+    InterlockedExchange(&g_stop, TRUE);
+    return TRUE;
+}
+
+static BOOL parse_length(const char *text, BP_LENGTH *length)
+{
+    switch (atoi(text))
+    {
+    case 1:
+        *length = ONE_BYTE;
+        return TRUE;
+    case 2:
+        *length = TWO_BYTE;
+        return TRUE;
+    case 4:
+        *length = FOUR_BYTE;
+        return TRUE;
+    case 8:
+        *length = EIGHT_BYTE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static BOOL resolve(const char *location, DWORD64 *address)
+{
+    char name[128];
+    DWORD64 offset = 0;
+
+    strncpy_s(name, sizeof(name), location, _TRUNCATE);
+
+    char *plus = strrchr(name, '+');
+    if (plus)
+    {
+        *plus = '\0';
+        offset = _strtoui64(plus + 1, NULL, 0);
+    }
+
+    if (!_strnicmp(name, "0x", 2))
+    {
+        *address = _strtoui64(name, NULL, 16) + offset;
+        return TRUE;
+    }
+
+    BYTE buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    PSYMBOL_INFO symbol = (PSYMBOL_INFO)buffer;
+    symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    symbol->MaxNameLen = MAX_SYM_NAME;
+
+    if (!SymFromName(g_hProcess, name, symbol))
+        return FALSE;
+
+    *address = symbol->Address + offset;
+    return TRUE;
+}
+
+// location:access[:length], parsed from the right since C++ symbols contain colons
+static BOOL parse_watch(const char *spec, WATCH *watch)
+{
+    char text[128];
+    strncpy_s(text, sizeof(text), spec, _TRUNCATE);
+    strncpy_s(watch->spec, sizeof(watch->spec), spec, _TRUNCATE);
+
+    char *colon = strrchr(text, ':');
+    if (!colon)
+        return FALSE;
+
+    watch->length = FOUR_BYTE;
+
+    if (colon[1] >= '0' && colon[1] <= '9')
+    {
+        if (!parse_length(colon + 1, &watch->length))
+            return FALSE;
+
+        *colon = '\0';
+        colon = strrchr(text, ':');
+        if (!colon)
+            return FALSE;
+    }
+
+    const char *access = colon + 1;
+    *colon = '\0';
+
+    if (!strcmp(access, "x"))
+    {
+        watch->read_write = INSTRUCTION_EXECUTION;
+        watch->length = ONE_BYTE;
+    }
+    else if (!strcmp(access, "w"))
+        watch->read_write = DATA_WRITEONLY;
+    else if (!strcmp(access, "r") || !strcmp(access, "rw"))
+        watch->read_write = DATA_READWRITE;
+    else
+        return FALSE;
+
+    if (!resolve(text, &watch->address))
+        return FALSE;
+
+    bp_init(&watch->bp, (LPVOID)watch->address, 0, watch->read_write, watch->length);
+    watch->bp.wow64 = (uint8_t)g_wow64;
+
+    return TRUE;
+}
+
+static void arm_thread(DWORD threadId, HANDLE hThread)
+{
+    CONTEXT ctx = {0};
+
+    for (DWORD i = 0; i < THREAD_MAX; i++)
+    {
+        if (!g_threads[i].threadId)
+        {
+            g_threads[i].threadId = threadId;
+            g_threads[i].hThread = hThread;
+            break;
+        }
+    }
+
+    // still recorded so it is known on exit, but no new watches once disarming
+    if (g_stop)
+        return;
+
+    // the whole process is frozen while a debug event is reported
+    if (!bp_get_debug_regs(hThread, g_wow64, &ctx))
+        return;
+
+    for (DWORD i = 0; i < g_watchCount; i++)
+        bp_encode_slot(&g_watches[i].bp, (int8_t)i, &ctx);
+
+    bp_set_debug_regs(hThread, g_wow64, &ctx);
+}
+
+static void disarm_threads(void)
+{
+    for (DWORD i = 0; i < THREAD_MAX; i++)
+    {
+        if (!g_threads[i].threadId)
+            continue;
+
+        CONTEXT ctx = {0};
+
+        // no debug event pending any more, the threads are running
+        if (SuspendThread(g_threads[i].hThread) == (DWORD)-1)
+            continue;
+
+        // only the slots we armed, the target may use the others itself
+        if (bp_get_debug_regs(g_threads[i].hThread, g_wow64, &ctx))
+        {
+            for (DWORD w = 0; w < g_watchCount; w++)
+                bp_clear_slot((int8_t)w, &ctx);
+
+            bp_set_debug_regs(g_threads[i].hThread, g_wow64, &ctx);
+        }
+
+        ResumeThread(g_threads[i].hThread);
+    }
+}
+
+static HANDLE find_thread(DWORD threadId)
+{
+    for (DWORD i = 0; i < THREAD_MAX; i++)
+    {
+        if (g_threads[i].threadId == threadId)
+            return g_threads[i].hThread;
+    }
+
+    return NULL;
+}
+
+static void forget_thread(DWORD threadId)
+{
+    for (DWORD i = 0; i < THREAD_MAX; i++)
+    {
+        if (g_threads[i].threadId == threadId)
+            g_threads[i].threadId = 0;
+    }
+}
+
+// an execution watch traps before the instruction, resume past it
+static void set_resume_flag(HANDLE hThread)
+{
+    if (g_wow64)
+    {
+        WOW64_CONTEXT wctx = {0};
+        wctx.ContextFlags = WOW64_CONTEXT_CONTROL;
+
+        if (Wow64GetThreadContext(hThread, &wctx))
+        {
+            wctx.EFlags |= EFLAGS_RF;
+            Wow64SetThreadContext(hThread, &wctx);
+        }
+    }
+    else
+    {
+        CONTEXT ctx = {0};
+        ctx.ContextFlags = CONTEXT_CONTROL;
+
+        if (GetThreadContext(hThread, &ctx))
+        {
+            ctx.EFlags |= EFLAGS_RF;
+            SetThreadContext(hThread, &ctx);
+        }
+    }
+}
+
+// Returns TRUE when the single step was one of ours.
+static BOOL on_single_step(const DEBUG_EVENT *event)
+{
+    HANDLE hThread = find_thread(event->dwThreadId);
+    CONTEXT ctx = {0};
+
+    if (!hThread || !bp_get_debug_regs(hThread, g_wow64, &ctx))
+        return FALSE;
+
+    DWORD hit = (DWORD)(ctx.Dr6 & ((1ull << g_watchCount) - 1));
+    if (!hit)
+        return FALSE;
+
+    HIT record;
+    record.threadId = event->dwThreadId;
+    record.ip = (DWORD64)event->u.Exception.ExceptionRecord.ExceptionAddress;
+
+    for (record.watch = 0; !(hit & (1 << record.watch)); record.watch++)
+        ;
+
+    bp_ring_push(g_hits, &record);
+
+    ctx.Dr6 = 0;
+    bp_set_debug_regs(hThread, g_wow64, &ctx);
+
+    if (g_watches[record.watch].read_write == INSTRUCTION_EXECUTION)
+        set_resume_flag(hThread); // or the instruction traps again when resumed
+
+    return TRUE;
+}
+
+static STAT *find_stat(const HIT *hit)
+{
+    for (DWORD i = 0; i < g_statCount; i++)
+    {
+        STAT *stat = &g_stats[i];
+        if (stat->ip == hit->ip && stat->threadId == hit->threadId && stat->watch == hit->watch)
+            return stat;
+    }
+
+    if (g_statCount == STAT_MAX)
+        return NULL;
+
+    STAT *stat = &g_stats[g_statCount++];
+    stat->ip = hit->ip;
+    stat->threadId = hit->threadId;
+    stat->watch = hit->watch;
+
+    return stat;
+}
+
+static int compare_stats(const void *a, const void *b)
+{
+    const STAT *x = (const STAT *)a, *y = (const STAT *)b;
+
+    if (x->window != y->window)
+        return x->window > y->window ? -1 : 1;
+    if (x->total != y->total)
+        return x->total > y->total ? -1 : 1;
+
+    return 0;
+}
+
+static void format_ip(DWORD64 ip, char *text, SIZE_T size)
+{
+    BYTE buffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME];
+    PSYMBOL_INFO symbol = (PSYMBOL_INFO)buffer;
+    DWORD64 displacement = 0;
+    IMAGEHLP_MODULE64 module = {0};
+
+    symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+    symbol->MaxNameLen = MAX_SYM_NAME;
+    module.SizeOfStruct = sizeof(module);
+
+    if (SymFromAddr(g_hProcess, ip, &displacement, symbol))
+    {
+        const char *moduleName = SymGetModuleInfo64(g_hProcess, ip, &module) ? module.ModuleName : "?";
+        sprintf_s(text, size, "%s!%s+0x%llx", moduleName, symbol->Name, displacement);
+    }
+    else
+    {
+        sprintf_s(text, size, "0x%llx", ip);
+    }
+}
+
+static DWORD WINAPI display(LPVOID param)
+{
+    UNREFERENCED_PARAMETER(param);
+
+    DWORD pid = GetProcessId(g_hProcess);
+
+    while (!g_stop)
+    {
+        Sleep(1000);
+
+        HIT hit;
+        LONG64 events = 0;
+
+        for (DWORD i = 0; i < g_statCount; i++)
+            g_stats[i].window = 0;
+
+        while (bp_ring_pop(g_hits, &hit))
+        {
+            STAT *stat = find_stat(&hit);
+            if (stat)
+            {
+                stat->total++;
+                stat->window++;
+            }
+            events++;
+        }
+
+        qsort(g_stats, g_statCount, sizeof(STAT), compare_stats);
+
+        printf("\x1b[H\x1b[2J");
+        printf("hwbp-watch  pid %lu  hits/s %lld  dropped %lld\n\n", pid, events, g_hits->dropped);
+
+        for (DWORD i = 0; i < g_watchCount; i++)
+            printf("  #%lu  0x%016llx  %s\n", i, g_watches[i].address, g_watches[i].spec);
+
+        printf("\n  %8s %10s %7s %5s  %s\n", "HITS/S", "TOTAL", "TID", "WATCH", "IP");
+
+        for (DWORD i = 0; i < g_statCount && i < ROWS; i++)
+        {
+            char ip[MAX_SYM_NAME + 64];
+            format_ip(g_stats[i].ip, ip, sizeof(ip));
+            printf("  %8lld %10lld %7lu %5lu  %s\n", g_stats[i].window, g_stats[i].total, g_stats[i].threadId,
+                   g_stats[i].watch, ip);
+        }
+
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+static void handle_event(DEBUG_EVENT *event)
+{
+    DWORD status = DBG_CONTINUE;
+    DWORD code;
+
+    switch (event->dwDebugEventCode)
+    {
+    case CREATE_PROCESS_DEBUG_EVENT:
+        if (event->u.CreateProcessInfo.hFile)
+            CloseHandle(event->u.CreateProcessInfo.hFile);
+        arm_thread(event->dwThreadId, event->u.CreateProcessInfo.hThread);
+        break;
+
+    case CREATE_THREAD_DEBUG_EVENT:
+        arm_thread(event->dwThreadId, event->u.CreateThread.hThread);
+        break;
+
+    case EXIT_THREAD_DEBUG_EVENT:
+        forget_thread(event->dwThreadId);
+        break;
+
+    case LOAD_DLL_DEBUG_EVENT:
+        if (event->u.LoadDll.hFile)
+            CloseHandle(event->u.LoadDll.hFile);
+        break;
+
+    case EXCEPTION_DEBUG_EVENT:
+        code = event->u.Exception.ExceptionRecord.ExceptionCode;
+        if (code == EXCEPTION_SINGLE_STEP || code == STATUS_WX86_SINGLE_STEP)
+            status = on_single_step(event) ? DBG_CONTINUE : DBG_EXCEPTION_NOT_HANDLED;
+        else if (code != EXCEPTION_BREAKPOINT && code != STATUS_WX86_BREAKPOINT)
+            status = DBG_EXCEPTION_NOT_HANDLED; // the attach breakpoint is ours, the rest the target's
+        break;
+
+    case EXIT_PROCESS_DEBUG_EVENT:
+        InterlockedExchange(&g_stop, TRUE);
+        break;
+    }
+
+    ContinueDebugEvent(event->dwProcessId, event->dwThreadId, status);
+}
+
+static void debug_loop(void)
+{
+    DEBUG_EVENT event;
+
+    while (!g_stop)
+    {
+        if (WaitForDebugEvent(&event, 100))
+            handle_event(&event);
+    }
+}
+
+// Hits raised before the watches came off are still queued. Left to the target after
+// detaching, such a single step would be an unhandled exception, so they are taken here.
+static void drain_events(void)
+{
+    DEBUG_EVENT event;
+
+    while (WaitForDebugEvent(&event, 50))
+        handle_event(&event);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 2 + WATCH_MAX)
+    {
+        fprintf(stderr, "usage: hwbp-watch <pid> <location>:<r|w|rw|x>[:<length>] ... (up to %d)\n", WATCH_MAX);
+        return 1;
+    }
+
+    DWORD pid = strtoul(argv[1], NULL, 0);
+    BOOL wow64 = FALSE;
+
+    g_hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid);
+    if (!g_hProcess)
+    {
+        fprintf(stderr, "cannot open process %lu (%lu)\n", pid, GetLastError());
+        return 1;
+    }
+
+    if (!IsWow64Process(g_hProcess, &wow64))
+        wow64 = FALSE;
+    g_wow64 = wow64;
+
+    SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | (wow64 ? SYMOPT_INCLUDE_32BIT_MODULES : 0));
+    if (!SymInitialize(g_hProcess, NULL, TRUE))
+    {
+        fprintf(stderr, "cannot load symbols (%lu)\n", GetLastError());
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (!parse_watch(argv[i], &g_watches[g_watchCount]))
+        {
+            fprintf(stderr, "cannot resolve watch '%s'\n", argv[i]);
+            return 1;
+        }
+
+        if (wow64 && (g_watches[g_watchCount].address > MAXDWORD || g_watches[g_watchCount].length == EIGHT_BYTE))
+        {
+            fprintf(stderr, "watch '%s' does not fit a 32-bit process\n", argv[i]);
+            return 1;
+        }
+
+        g_watchCount++;
+    }
+
+    g_hits = bp_ring_create(sizeof(HIT), RING_CAPACITY);
+    if (!g_hits)
+        return 1;
+
+    // VT sequences for the redraw
+    DWORD mode;
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (GetConsoleMode(hOut, &mode))
+        SetConsoleMode(hOut, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+    SetConsoleCtrlHandler(on_ctrl, TRUE);
+
+    if (!DebugActiveProcess(pid))
+    {
+        fprintf(stderr, "cannot attach to process %lu (%lu)\n", pid, GetLastError());
+        return 1;
+    }
+
+    DebugSetProcessKillOnExit(FALSE);
+
+    HANDLE hDisplay = CreateThread(NULL, 0, display, NULL, 0, NULL);
+
+    debug_loop();
+
+    // leave the target as it was found
+    disarm_threads();
+    drain_events();
+    DebugActiveProcessStop(pid);
+
+    if (hDisplay)
+    {
+        WaitForSingleObject(hDisplay, INFINITE);
+        CloseHandle(hDisplay);
+    }
+
+    SymCleanup(g_hProcess);
+    CloseHandle(g_hProcess);
+    bp_ring_destroy(g_hits);
+
+    return 0;
+}
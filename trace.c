@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static void trace_exit(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    PHWBP_TRACE_THREAD thread = (PHWBP_TRACE_THREAD)param;
+
+    // the return address was reached by a different (e.g. recursive) frame
+    if (ctx->Rsp != thread->retRsp)
+        return;
+
+    HWBP_TRACE_RECORD record = {0};
+    record.event = HWBP_TRACE_EXIT;
+    record.function = thread->retFunction;
+    record.threadId = bp->threadId;
+    record.callId = thread->retCallId;
+    record.retval = ctx->Rax;
+    QueryPerformanceCounter(&record.timestamp);
+
+    bp_disable_ctx(bp, ctx);
+    bp_ring_push(thread->tracer->ring, &record);
+}
+
+static void trace_entry(PHWBP bp, PCONTEXT ctx, LPVOID param)
+{
+    PHWBP_TRACE_THREAD thread = (PHWBP_TRACE_THREAD)param;
+    PHWBP_TRACER tracer = thread->tracer;
+    uint8_t function = (uint8_t)(bp - thread->entry);
+    DWORD64 *stack = (DWORD64 *)ctx->Rsp;
+
+    HWBP_TRACE_RECORD record = {0};
+    record.event = HWBP_TRACE_ENTRY;
+    record.function = function;
+    record.threadId = bp->threadId;
+    record.callId = (DWORD64)InterlockedIncrement64(&tracer->nextCallId);
+    QueryPerformanceCounter(&record.timestamp);
+
+    // [rsp] is the return address, [rsp+8..0x20] the home area of the register arguments
+    DWORD64 regs[4] = {ctx->Rcx, ctx->Rdx, ctx->R8, ctx->R9};
+    for (uint8_t i = 0; i < tracer->functions[function].argc && i < HWBP_TRACE_MAX_ARGS; i++)
+        record.args[i] = i < 4 ? regs[i] : stack[i + 1];
+
+    // only the outermost call is followed to its return, one slot per thread
+    if (!thread->ret.enabled)
+    {
+        thread->ret.target = (LPVOID)stack[0];
+        thread->retRsp = ctx->Rsp + sizeof(DWORD64);
+        thread->retCallId = record.callId;
+        thread->retFunction = function;
+        record.exitPending = (uint8_t)bp_enable_ctx(&thread->ret, ctx);
+    }
+
+    bp_ring_push(tracer->ring, &record);
+}
+
+PHWBP_TRACER bp_trace_create(SIZE_T capacity)
+{
+    PHWBP_TRACER tracer = (PHWBP_TRACER)calloc(1, sizeof(HWBP_TRACER));
+    if (!tracer)
+        return NULL;
+
+    tracer->ring = bp_ring_create(sizeof(HWBP_TRACE_RECORD), capacity);
+    if (!tracer->ring)
+    {
+        free(tracer);
+        return NULL;
+    }
+
+    return tracer;
+}
+
+void bp_trace_destroy(PHWBP_TRACER tracer)
+{
+    while (tracer->threads)
+        bp_trace_detach(tracer, tracer->threads->ret.threadId);
+
+    bp_ring_destroy(tracer->ring);
+    free(tracer);
+}
+
+int8_t bp_trace_add_address(PHWBP_TRACER tracer, LPVOID address, LPCSTR name, uint8_t argc)
+{
+    if (!address || tracer->threads || tracer->count == HWBP_TRACE_MAX_FUNCTIONS)
+        return -1;
+
+    PHWBP_TRACE_FUNCTION function = &tracer->functions[tracer->count];
+    function->address = address;
+    function->argc = argc > HWBP_TRACE_MAX_ARGS ? HWBP_TRACE_MAX_ARGS : argc;
+    strncpy_s(function->name, sizeof(function->name), name ? name : "", _TRUNCATE);
+
+    return (int8_t)tracer->count++;
+}
+
+int8_t bp_trace_add(PHWBP_TRACER tracer, LPCSTR module, LPCSTR function, uint8_t argc)
+{
+    HMODULE hModule = GetModuleHandleA(module);
+    if (!hModule)
+        return -1;
+
+    return bp_trace_add_address(tracer, (LPVOID)GetProcAddress(hModule, function), function, argc);
+}
+
+BOOL bp_trace_attach(PHWBP_TRACER tracer, DWORD threadId)
+{
+    PHWBP_TRACE_THREAD thread = (PHWBP_TRACE_THREAD)calloc(1, sizeof(HWBP_TRACE_THREAD));
+    if (!thread)
+        return FALSE;
+
+    thread->tracer = tracer;
+
+    bp_init(&thread->ret, NULL, threadId, INSTRUCTION_EXECUTION, ONE_BYTE);
+    bp_set_callback(&thread->ret, trace_exit, thread);
+
+    for (uint8_t i = 0; i < tracer->count; i++)
+    {
+        bp_init(&thread->entry[i], tracer->functions[i].address, threadId, INSTRUCTION_EXECUTION, ONE_BYTE);
+
+        if (!bp_set_callback(&thread->entry[i], trace_entry, thread) || !bp_enable(&thread->entry[i]))
+        {
+            while (i--)
+            {
+                bp_disable(&thread->entry[i]);
+                bp_drain(&thread->entry[i]);
+            }
+
+            free(thread);
+            return FALSE;
+        }
+    }
+
+    thread->next = tracer->threads;
+    tracer->threads = thread;
+
+    return TRUE;
+}
+
+BOOL bp_trace_detach(PHWBP_TRACER tracer, DWORD threadId)
+{
+    for (PHWBP_TRACE_THREAD *link = &tracer->threads; *link; link = &(*link)->next)
+    {
+        PHWBP_TRACE_THREAD thread = *link;
+
+        if (thread->ret.threadId != threadId)
+            continue;
+
+        for (uint8_t i = 0; i < tracer->count; i++)
+            bp_disable(&thread->entry[i]);
+
+        if (thread->ret.enabled)
+            bp_disable(&thread->ret);
+
+        // the handler may still be running their callbacks on the traced thread
+        for (uint8_t i = 0; i < tracer->count; i++)
+            bp_drain(&thread->entry[i]);
+        bp_drain(&thread->ret);
+
+        *link = thread->next;
+        free(thread);
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL bp_trace_read(PHWBP_TRACER tracer, PHWBP_TRACE_RECORD record)
+{
+    return bp_ring_pop(tracer->ring, record);
+}
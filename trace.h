@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+#include "ring.h"
+
+// Per-call tracing of a few API functions (e.g. NtReadFile, NtWriteFile, WSASend,
+// WaitOnAddress) with INSTRUCTION_EXECUTION breakpoints on their entry points.
+// Arguments are captured from the Microsoft x64 calling convention registers
+// (RCX, RDX, R8, R9, then the stack after the 32 byte home area) and the return
+// value from RAX through a one-shot breakpoint on the return address.
+
+#define HWBP_TRACE_MAX_FUNCTIONS 4
+#define HWBP_TRACE_MAX_ARGS 6
+
+typedef enum
+{
+    HWBP_TRACE_ENTRY = 0,
+    HWBP_TRACE_EXIT = 1
+} HWBP_TRACE_EVENT;
+
+typedef struct _HWBP_TRACE_RECORD
+{
+    HWBP_TRACE_EVENT event;
+    uint8_t function;
+    uint8_t exitPending; // ENTRY only: an EXIT record with the same callId follows
+    DWORD threadId;
+    DWORD64 callId;
+    LARGE_INTEGER timestamp;
+    DWORD64 args[HWBP_TRACE_MAX_ARGS]; // ENTRY only
+    DWORD64 retval;                    // EXIT only
+} HWBP_TRACE_RECORD, *PHWBP_TRACE_RECORD;
+
+typedef struct _HWBP_TRACE_FUNCTION
+{
+    LPVOID address;
+    CHAR name[64];
+    uint8_t argc;
+} HWBP_TRACE_FUNCTION, *PHWBP_TRACE_FUNCTION;
+
+struct _HWBP_TRACER;
+
+typedef struct _HWBP_TRACE_THREAD
+{
+    struct _HWBP_TRACER *tracer;
+    struct _HWBP_TRACE_THREAD *next;
+    HWBP entry[HWBP_TRACE_MAX_FUNCTIONS];
+    HWBP ret;
+    DWORD64 retRsp;
+    DWORD64 retCallId;
+    uint8_t retFunction;
+} HWBP_TRACE_THREAD, *PHWBP_TRACE_THREAD;
+
+typedef struct _HWBP_TRACER
+{
+    HWBP_TRACE_FUNCTION functions[HWBP_TRACE_MAX_FUNCTIONS];
+    uint8_t count;
+    PHWBP_TRACE_THREAD threads;
+    PHWBP_RING ring;
+    volatile LONG64 nextCallId;
+} HWBP_TRACER, *PHWBP_TRACER;
+
+EXTERN_C_START
+
+PHWBP_TRACER bp_trace_create(SIZE_T capacity);
+void bp_trace_destroy(PHWBP_TRACER tracer);
+
+// Functions must be added before the first attach. Each takes one slot per thread;
+// the return value is only captured while a slot is left for the return breakpoint.
+int8_t bp_trace_add(PHWBP_TRACER tracer, LPCSTR module, LPCSTR function, uint8_t argc);
+int8_t bp_trace_add_address(PHWBP_TRACER tracer, LPVOID address, LPCSTR name, uint8_t argc);
+
+BOOL bp_trace_attach(PHWBP_TRACER tracer, DWORD threadId);
+BOOL bp_trace_detach(PHWBP_TRACER tracer, DWORD threadId);
+
+// Pops the oldest record, FALSE when none are pending.
+BOOL bp_trace_read(PHWBP_TRACER tracer, PHWBP_TRACE_RECORD record);
+
+EXTERN_C_END
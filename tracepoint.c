@@ -0,0 +1,58 @@
+#include <string.h>
+#include "tracepoint.h"
+
+#ifdef _MSC_VER
+#pragma section(".hwbptp$a", read)
+#pragma section(".hwbptp$z", read)
+#define HWBP_TRACEPOINT_MARKER(suffix) __declspec(allocate(".hwbptp$" #suffix))
+#else
+#define HWBP_TRACEPOINT_MARKER(suffix) __attribute__((section(".hwbptp$" #suffix), used))
+#endif
+
+HWBP_TRACEPOINT_MARKER(a) static const HWBP_TRACEPOINT_SITE *const g_tracepoints_begin = NULL;
+HWBP_TRACEPOINT_MARKER(z) static const HWBP_TRACEPOINT_SITE *const g_tracepoints_end = NULL;
+
+void bp_tracepoint_enum(BOOL (*fn)(const HWBP_TRACEPOINT_SITE *site, LPVOID param), LPVOID param)
+{
+    // the linker may pad between contributions, padding reads as NULL
+    for (const HWBP_TRACEPOINT_SITE *const *it = &g_tracepoints_begin + 1; it < &g_tracepoints_end; it++)
+    {
+        if (*it && !fn(*it, param))
+            return;
+    }
+}
+
+typedef struct _HWBP_TRACEPOINT_QUERY
+{
+    LPCSTR name;
+    const HWBP_TRACEPOINT_SITE *site;
+} HWBP_TRACEPOINT_QUERY;
+
+static BOOL tracepoint_match(const HWBP_TRACEPOINT_SITE *site, LPVOID param)
+{
+    HWBP_TRACEPOINT_QUERY *query = (HWBP_TRACEPOINT_QUERY *)param;
+
+    if (strcmp(site->name, query->name) != 0)
+        return TRUE;
+
+    query->site = site;
+    return FALSE;
+}
+
+const HWBP_TRACEPOINT_SITE *bp_tracepoint_find(LPCSTR name)
+{
+    HWBP_TRACEPOINT_QUERY query = {name, NULL};
+
+    bp_tracepoint_enum(tracepoint_match, &query);
+
+    return query.site;
+}
+
+PHWBP bp_tracepoint_create(LPCSTR name, DWORD threadId)
+{
+    const HWBP_TRACEPOINT_SITE *site = bp_tracepoint_find(name);
+    if (!site)
+        return NULL;
+
+    return bp_create(site->address, threadId, INSTRUCTION_EXECUTION, ONE_BYTE);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Windows.h>
+#include "hwbp.h"
+
+// Named static tracepoints for hot code.
+//
+//   HWBP_TRACEPOINT_DEFINE(request_done, (int id, size_t bytes))   // file scope
+//   HWBP_TRACEPOINT(request_done, id, bytes);                      // in the hot path
+//
+// A tracepoint is a call to an empty, never inlined function: no branch and no memory
+// access at the site, the arguments are simply in RCX, RDX, R8 and R9 when it is entered.
+// bp_tracepoint_create arms an INSTRUCTION_EXECUTION breakpoint on that function, so
+// nothing is patched. Every definition registers itself in the .hwbptp section, which the
+// linker collects between the $a and $z markers in tracepoint.c.
+
+typedef struct _HWBP_TRACEPOINT_SITE
+{
+    LPCSTR name;
+    LPVOID address;
+} HWBP_TRACEPOINT_SITE, *PHWBP_TRACEPOINT_SITE;
+
+#ifdef _MSC_VER
+#pragma section(".hwbptp$m", read)
+#define HWBP_TRACEPOINT_SECTION __declspec(allocate(".hwbptp$m"))
+#define HWBP_TRACEPOINT_NOINLINE __declspec(noinline)
+#define HWBP_TRACEPOINT_BARRIER
+#else
+#define HWBP_TRACEPOINT_SECTION __attribute__((section(".hwbptp$m"), used))
+#define HWBP_TRACEPOINT_NOINLINE __attribute__((noinline))
+// noinline alone still lets GCC drop a call to a side-effect free function whose result
+// is unused, an empty asm statement counts as a side effect
+#define HWBP_TRACEPOINT_BARRIER __asm__ volatile("")
+#endif
+
+// The stub returns its own site so no two stubs have identical code and the linker
+// cannot fold them into one address. It has external linkage, so a tracepoint name
+// must be unique within the image.
+#define HWBP_TRACEPOINT_DEFINE(name, params)                                                                    \
+    LONG_PTR hwbp_tp_##name params;                                                                             \
+    static const HWBP_TRACEPOINT_SITE hwbp_tp_site_##name = {#name, (LPVOID)hwbp_tp_##name};                    \
+    HWBP_TRACEPOINT_SECTION static const HWBP_TRACEPOINT_SITE *const hwbp_tp_ref_##name = &hwbp_tp_site_##name; \
+    HWBP_TRACEPOINT_NOINLINE LONG_PTR hwbp_tp_##name params                                                     \
+    {                                                                                                           \
+        HWBP_TRACEPOINT_BARRIER;                                                                                \
+        return (LONG_PTR)&hwbp_tp_site_##name;                                                                  \
+    }
+
+#define HWBP_TRACEPOINT(name, ...) ((void)hwbp_tp_##name(__VA_ARGS__))
+
+EXTERN_C_START
+
+const HWBP_TRACEPOINT_SITE *bp_tracepoint_find(LPCSTR name);
+
+// Calls fn for every registered tracepoint until it returns FALSE.
+void bp_tracepoint_enum(BOOL (*fn)(const HWBP_TRACEPOINT_SITE *site, LPVOID param), LPVOID param);
+
+// Creates (but does not enable) an execution breakpoint on the tracepoint for threadId.
+// Attach a callback or a sampler (sample.h) to read its arguments on hit.
+PHWBP bp_tracepoint_create(LPCSTR name, DWORD threadId);
+
+EXTERN_C_END